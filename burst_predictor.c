@@ -0,0 +1,299 @@
+#include "burst_predictor.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+//table slots (power of two) and how many slots one key may probe; a full
+//probe window evicts its least recently used entry
+#define BURST_TABLE_SIZE 1024
+#define BURST_PROBE 8
+
+//weight of the newest sample in the average
+#define BURST_ALPHA 0.5
+
+//characters of a command kept for the history file (readability only: the
+//key is a hash of the whole text)
+#define BURST_LABEL_MAX 48
+
+#define BURST_FILE_HEADER "# myshell burst history v1\n"
+
+typedef struct
+{
+    uint64_t key;               //0: free slot
+    double average_ms;
+    unsigned int samples;
+    uint64_t last_used;         //table clock at the latest lookup or sample
+    char kind;                  //'n': command name, 'c': full command line
+    char label[BURST_LABEL_MAX];
+} BurstEntry;
+
+static BurstEntry g_table[BURST_TABLE_SIZE];
+static uint64_t g_clock = 0;
+static int g_dirty = 0;
+
+static pthread_mutex_t burst_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//FNV-1a over the kind and the text, never 0 (the free-slot marker)
+static uint64_t burst_key(char kind, const char *text, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    hash = (hash ^ (unsigned char)kind) * 1099511628211ull;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (unsigned char)text[i]) * 1099511628211ull;
+    }
+
+    return hash != 0 ? hash : 1;
+}
+
+//finding the command name: the first word without its directory part
+static const char *command_name(const char *command, size_t *length)
+{
+    const char *start;
+    const char *end;
+
+    while (*command == ' ' || *command == '\t')
+    {
+        command++;
+    }
+
+    end = command;
+
+    while (*end != '\0' && *end != ' ' && *end != '\t')
+    {
+        end++;
+    }
+
+    start = command;
+
+    for (const char *p = command; p < end; p++)
+    {
+        if (*p == '/' && p + 1 < end)
+        {
+            start = p + 1;
+        }
+    }
+
+    *length = (size_t)(end - start);
+
+    return start;
+}
+
+//finding a key's entry (caller holds burst_mutex); with create set a free or
+//the least recently used slot of its probe window is claimed for it
+static BurstEntry *burst_find(uint64_t key, int create)
+{
+    BurstEntry *victim = NULL;
+
+    for (int i = 0; i < BURST_PROBE; i++)
+    {
+        BurstEntry *entry = &g_table[(key + (uint64_t)i) & (BURST_TABLE_SIZE - 1)];
+
+        if (entry->key == key)
+        {
+            return entry;
+        }
+
+        //a free slot wins, otherwise the stalest entry
+        if (victim == NULL ||
+            (victim->key != 0 && (entry->key == 0 || entry->last_used < victim->last_used)))
+        {
+            victim = entry;
+        }
+    }
+
+    if (!create)
+    {
+        return NULL;
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->key = key;
+
+    return victim;
+}
+
+int burst_predict_ms(const char *command)
+{
+    size_t name_length;
+    const char *name = command_name(command, &name_length);
+    BurstEntry *entry;
+    double average = 0.0;
+
+    pthread_mutex_lock(&burst_mutex);
+
+    entry = burst_find(burst_key('c', command, strlen(command)), 0);
+
+    if (entry == NULL)
+    {
+        entry = burst_find(burst_key('n', name, name_length), 0);
+    }
+
+    if (entry != NULL)
+    {
+        entry->last_used = ++g_clock;
+        average = entry->average_ms;
+    }
+
+    pthread_mutex_unlock(&burst_mutex);
+
+    return (int)(average + 0.5);
+}
+
+//folding one sample into an entry (caller holds burst_mutex)
+static void burst_sample(char kind, const char *text, size_t length, uint64_t runtime_ms)
+{
+    BurstEntry *entry = burst_find(burst_key(kind, text, length), 1);
+
+    if (entry->samples == 0)
+    {
+        size_t copy = length < BURST_LABEL_MAX - 1 ? length : BURST_LABEL_MAX - 1;
+
+        entry->kind = kind;
+        memcpy(entry->label, text, copy);
+        entry->label[copy] = '\0';
+        entry->average_ms = (double)runtime_ms;
+    }
+    else
+    {
+        entry->average_ms += BURST_ALPHA * ((double)runtime_ms - entry->average_ms);
+    }
+
+    entry->samples++;
+    entry->last_used = ++g_clock;
+}
+
+void burst_predictor_record(const char *command, uint64_t runtime_ms)
+{
+    size_t name_length;
+    const char *name = command_name(command, &name_length);
+
+    if (name_length == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&burst_mutex);
+
+    burst_sample('c', command, strlen(command), runtime_ms);
+    burst_sample('n', name, name_length, runtime_ms);
+    g_dirty = 1;
+
+    pthread_mutex_unlock(&burst_mutex);
+}
+
+/* ---------- persistence ---------- */
+int burst_predictor_load(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int loaded = 0;
+
+    if (fp == NULL)
+    {
+        return 0;
+    }
+
+    if (fgets(line, sizeof(line), fp) == NULL || strcmp(line, BURST_FILE_HEADER) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    pthread_mutex_lock(&burst_mutex);
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned long long key;
+        char kind;
+        double average;
+        unsigned int samples;
+        char label[BURST_LABEL_MAX];
+        BurstEntry *entry;
+
+        if (sscanf(line, "%llx %c %lf %u %47[^\n]", &key, &kind, &average, &samples, label) != 5 ||
+            key == 0 || samples == 0)
+        {
+            continue;
+        }
+
+        entry = burst_find((uint64_t)key, 1);
+        entry->kind = kind;
+        entry->average_ms = average;
+        entry->samples = samples;
+        entry->last_used = ++g_clock;
+        memcpy(entry->label, label, sizeof(entry->label));
+        loaded++;
+    }
+
+    g_dirty = 0;
+
+    pthread_mutex_unlock(&burst_mutex);
+
+    fclose(fp);
+
+    return loaded;
+}
+
+int burst_predictor_save(const char *path)
+{
+    char tmp_path[512];
+    FILE *fp;
+    int rc = 0;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&burst_mutex);
+
+    if (!g_dirty)
+    {
+        pthread_mutex_unlock(&burst_mutex);
+        return 0;
+    }
+
+    fp = fopen(tmp_path, "w");
+
+    if (fp == NULL)
+    {
+        perror("fopen burst history");
+        pthread_mutex_unlock(&burst_mutex);
+        return -1;
+    }
+
+    fputs(BURST_FILE_HEADER, fp);
+
+    for (int i = 0; i < BURST_TABLE_SIZE; i++)
+    {
+        const BurstEntry *entry = &g_table[i];
+
+        if (entry->key != 0 && entry->samples > 0)
+        {
+            fprintf(fp, "%016llx %c %.1f %u %s\n",
+                    (unsigned long long)entry->key,
+                    entry->kind,
+                    entry->average_ms,
+                    entry->samples,
+                    entry->label);
+        }
+    }
+
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0)
+    {
+        perror("save burst history");
+        rc = -1;
+    }
+    else
+    {
+        g_dirty = 0;
+    }
+
+    pthread_mutex_unlock(&burst_mutex);
+
+    return rc;
+}
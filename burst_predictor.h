@@ -0,0 +1,29 @@
+#ifndef BURST_PREDICTOR_H
+#define BURST_PREDICTOR_H
+
+#include <stdint.h>
+
+//runtime history of shell commands: an exponentially weighted average of
+//measured runtimes per command name (first word, without its path) and per
+//full command line, kept in a bounded table that evicts the least recently
+//used entry and can be saved to and reloaded from a file
+
+//returns the predicted runtime of a command in ms: the full command line's
+//average when it has one, else its name's, else 0 (never seen: treated as
+//short until measured)
+int burst_predict_ms(const char *command);
+
+//feeding one measured runtime of a command into its averages
+void burst_predictor_record(const char *command, uint64_t runtime_ms);
+
+//loading averages saved by burst_predictor_save; a missing file is not an
+//error
+//returns the number of entries loaded, -1 when the file cannot be parsed
+int burst_predictor_load(const char *path);
+
+//writing the table to path (through a temporary file renamed over it) when
+//it changed since the last load or save
+//returns 0 on success or when nothing changed, -1 on error
+int burst_predictor_save(const char *path);
+
+#endif
@@ -0,0 +1,352 @@
+#include "child_manager.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+//older C libraries lack the wrapper constant (the number is the same on
+//every architecture but alpha)
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+//child table buckets (chained; live children are few)
+#define CHILD_BUCKETS 256
+
+typedef struct ChildEntry
+{
+    pid_t pid;
+    int fd;                     //pidfd, or an eventfd in signalfd mode
+    int exited;                 //status and usage below are valid
+    int status;
+    struct rusage usage;
+
+    struct ChildEntry *next;
+} ChildEntry;
+
+static ChildEntry *g_children[CHILD_BUCKETS];
+
+static int g_use_pidfd = 1;
+
+//signalfd mode: the SIGCHLD signalfd and the mask before SIGCHLD was blocked
+static int g_signal_fd = -1;
+static sigset_t g_saved_mask;
+
+static pthread_mutex_t child_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int pidfd_open_pid(pid_t pid)
+{
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+//finding a child's entry (caller holds child_mutex)
+static ChildEntry *child_lookup(pid_t pid)
+{
+    ChildEntry *entry = g_children[(unsigned int)pid % CHILD_BUCKETS];
+
+    while (entry != NULL && entry->pid != pid)
+    {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+//reaping a child that has exited without waiting for one that has not
+//(caller holds child_mutex)
+//returns 1 when it has exited
+static int child_try_reap(ChildEntry *entry)
+{
+    pid_t rc;
+
+    if (entry->exited)
+    {
+        return 1;
+    }
+
+    do
+    {
+        rc = wait4(entry->pid, &entry->status, WNOHANG, &entry->usage);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc == entry->pid)
+    {
+        entry->exited = 1;
+    }
+
+    return entry->exited;
+}
+
+//signalfd mode: reaping every registered child that exited whenever SIGCHLD
+//arrives (signals coalesce, so each one triggers a scan of the whole table)
+//and signalling its eventfd
+static void *child_reaper(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        struct signalfd_siginfo info;
+        uint64_t one = 1;
+
+        if (read(g_signal_fd, &info, sizeof(info)) < 0)
+        {
+            if (errno != EINTR)
+            {
+                perror("signalfd read");
+            }
+
+            continue;
+        }
+
+        pthread_mutex_lock(&child_mutex);
+
+        for (int i = 0; i < CHILD_BUCKETS; i++)
+        {
+            for (ChildEntry *entry = g_children[i]; entry != NULL; entry = entry->next)
+            {
+                if (!entry->exited && child_try_reap(entry) &&
+                    write(entry->fd, &one, sizeof(one)) < 0)
+                {
+                    perror("eventfd write");
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&child_mutex);
+    }
+
+    return NULL;
+}
+
+int child_manager_init(void)
+{
+    const char *mode = getenv("MYSHELL_CHILD");
+    int probe = -1;
+    sigset_t mask;
+    pthread_t tid;
+
+    //pidfd_open works on any live process: probing with our own pid
+    if (mode == NULL || strcmp(mode, "signalfd") != 0)
+    {
+        probe = pidfd_open_pid(getpid());
+    }
+
+    if (probe >= 0)
+    {
+        close(probe);
+        g_use_pidfd = 1;
+        return 0;
+    }
+
+    g_use_pidfd = 0;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, &g_saved_mask) != 0)
+    {
+        perror("pthread_sigmask");
+        return -1;
+    }
+
+    g_signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    if (g_signal_fd < 0)
+    {
+        perror("signalfd");
+        pthread_sigmask(SIG_SETMASK, &g_saved_mask, NULL);
+        return -1;
+    }
+
+    if (pthread_create(&tid, NULL, child_reaper, NULL) != 0)
+    {
+        perror("pthread_create reaper");
+        close(g_signal_fd);
+        g_signal_fd = -1;
+        pthread_sigmask(SIG_SETMASK, &g_saved_mask, NULL);
+        return -1;
+    }
+
+    pthread_detach(tid);
+
+    return 0;
+}
+
+const char *child_manager_backend(void)
+{
+    return g_use_pidfd ? "pidfd" : "signalfd";
+}
+
+void child_manager_child_setup(void)
+{
+    if (!g_use_pidfd)
+    {
+        sigprocmask(SIG_SETMASK, &g_saved_mask, NULL);
+    }
+}
+
+int child_watch(pid_t pid)
+{
+    ChildEntry *entry = (ChildEntry *)calloc(1, sizeof(ChildEntry));
+    unsigned int bucket = (unsigned int)pid % CHILD_BUCKETS;
+
+    if (entry == NULL)
+    {
+        perror("calloc child");
+        return -1;
+    }
+
+    entry->pid = pid;
+    //pidfds are always close-on-exec
+    entry->fd = g_use_pidfd ? pidfd_open_pid(pid) : eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (entry->fd < 0)
+    {
+        perror(g_use_pidfd ? "pidfd_open" : "eventfd");
+        free(entry);
+        return -1;
+    }
+
+    pthread_mutex_lock(&child_mutex);
+
+    entry->next = g_children[bucket];
+    g_children[bucket] = entry;
+
+    //a child that exited before it was registered raised its SIGCHLD
+    //already: look once now
+    if (!g_use_pidfd && child_try_reap(entry))
+    {
+        uint64_t one = 1;
+
+        if (write(entry->fd, &one, sizeof(one)) < 0)
+        {
+            perror("eventfd write");
+        }
+    }
+
+    pthread_mutex_unlock(&child_mutex);
+
+    return 0;
+}
+
+int child_watch_fd(pid_t pid)
+{
+    ChildEntry *entry;
+    int fd;
+
+    pthread_mutex_lock(&child_mutex);
+
+    entry = child_lookup(pid);
+    fd = entry != NULL ? entry->fd : -1;
+
+    pthread_mutex_unlock(&child_mutex);
+
+    return fd;
+}
+
+int child_collect(pid_t pid, int block, int *status, struct rusage *usage)
+{
+    ChildEntry *entry;
+    int exited;
+
+    pthread_mutex_lock(&child_mutex);
+
+    entry = child_lookup(pid);
+
+    //an unwatched child: a plain wait4
+    if (entry == NULL)
+    {
+        struct rusage ignored;
+        pid_t rc;
+
+        pthread_mutex_unlock(&child_mutex);
+
+        do
+        {
+            rc = wait4(pid, status, block ? 0 : WNOHANG, usage != NULL ? usage : &ignored);
+        } while (rc < 0 && errno == EINTR);
+
+        return rc == pid ? 1 : rc == 0 ? 0 : -1;
+    }
+
+    //in signalfd mode only the reaper thread reaps; waiting is polling the
+    //exit fd with the table unlocked (only the child's owner releases it)
+    while (!(g_use_pidfd ? child_try_reap(entry) : entry->exited) && block)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = entry->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        pthread_mutex_unlock(&child_mutex);
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        {
+            perror("poll child");
+            return -1;
+        }
+
+        pthread_mutex_lock(&child_mutex);
+    }
+
+    exited = entry->exited;
+
+    if (exited && status != NULL)
+    {
+        *status = entry->status;
+    }
+
+    if (exited && usage != NULL)
+    {
+        *usage = entry->usage;
+    }
+
+    pthread_mutex_unlock(&child_mutex);
+
+    return exited;
+}
+
+void child_release(pid_t pid)
+{
+    ChildEntry **link = &g_children[(unsigned int)pid % CHILD_BUCKETS];
+    ChildEntry *entry;
+
+    if (child_collect(pid, 1, NULL, NULL) < 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&child_mutex);
+
+    while (*link != NULL && (*link)->pid != pid)
+    {
+        link = &(*link)->next;
+    }
+
+    entry = *link;
+
+    if (entry != NULL)
+    {
+        *link = entry->next;
+    }
+
+    pthread_mutex_unlock(&child_mutex);
+
+    if (entry != NULL)
+    {
+        close(entry->fd);
+        free(entry);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef CHILD_MANAGER_H
+#define CHILD_MANAGER_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+//asynchronous child reaping: every spawned child is registered and gets a
+//pollable fd that turns readable once it has exited, so a caller can wait
+//for many children (and anything else) in one poll; its exit status and
+//rusage are then collected without blocking and kept until released
+//the fd is the child's pidfd, or where pidfd_open is missing (or with
+//MYSHELL_CHILD=signalfd) an eventfd signalled by a thread that reaps
+//registered children as a SIGCHLD signalfd reports them
+
+//choosing the mechanism; call before any other thread or child is started
+//(the fallback blocks SIGCHLD in every thread)
+//returns 0 on success, -1 when neither mechanism can be set up
+int child_manager_init(void);
+
+//returns "pidfd" or "signalfd"
+const char *child_manager_backend(void);
+
+//restoring the signal mask the manager changed; called by a forked child
+//before it execs
+void child_manager_child_setup(void);
+
+//registering a just forked child
+//returns 0 on success, -1 when it cannot be watched (collecting it then
+//falls back to a plain wait4)
+int child_watch(pid_t pid);
+
+//returns the fd to poll for the child's exit (it stays readable once the
+//child has exited), or -1 when the child is not watched
+int child_watch_fd(pid_t pid);
+
+//collecting a child's exit: *status and *usage (either may be null) are
+//filled; with block set it waits for the exit, otherwise returns at once;
+//a collected exit is kept, so asking again returns it again
+//returns 1 when the child has exited, 0 while it runs, -1 on error
+int child_collect(pid_t pid, int block, int *status, struct rusage *usage);
+
+//forgetting a child: it is collected first (blocking) when that has not
+//happened yet, then its watch fd is closed
+void child_release(pid_t pid);
+
+#endif
@@ -1,4 +1,5 @@
 #include "myshell.h"
+#include "protocol.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -6,9 +7,24 @@
 
 #define PORT 8080
 #define BUFFER_SIZE 4096
-#define END_MARKER "<<END>>"
 #define PORT_HINT_FILE ".myshell_port"
 
+//set by Ctrl-C; while a response is awaited it becomes a cancel request
+//for the running command
+static volatile sig_atomic_t g_interrupted = 0;
+
+//protocol of the session, whether a response is being awaited, and how
+//many more responses are owed beyond it (one per cancel request sent)
+static int g_proto = PROTO_TEXT;
+static int g_awaiting = 0;
+static int g_extra_responses = 0;
+
+static void handle_sigint(int sig)
+{
+    (void)sig;
+    g_interrupted = 1;
+}
+
 //parsing and validating a port string into an integer in range [1, 65535]
 //returning 0 on success, -1 on invalid input
 static int parse_port_str(const char *port_text, int *port_out)
@@ -73,6 +89,11 @@ static int send_all(int sockfd, const char *buffer, size_t length)
     while (total_sent < length)
     {
         ssize_t bytes_sent = send(sockfd, buffer + total_sent, length - total_sent, 0);
+        if (bytes_sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
         if (bytes_sent < 0)
         {
             perror("send");
@@ -85,8 +106,216 @@ static int send_all(int sockfd, const char *buffer, size_t length)
     return 0;
 }
 
-//receiving full server response until END_MARKER appears
-//this function handles partial recv() calls and marker splits across packets
+//sending one command as a FRAME_COMMAND frame (newline stripped)
+//returns 0 on success, -1 on failure
+static int send_command_frame(int sockfd, const char *command, size_t length)
+{
+    FrameHeader header;
+    unsigned char encoded[FRAME_HEADER_SIZE];
+
+    memset(&header, 0, sizeof(header));
+    header.version = PROTO_VERSION;
+    header.type = FRAME_COMMAND;
+    header.length = (uint32_t)length;
+    frame_encode(&header, encoded);
+
+    if (send_all(sockfd, (const char *)encoded, sizeof(encoded)) < 0)
+    {
+        return -1;
+    }
+
+    return send_all(sockfd, command, length);
+}
+
+//asking the server to cancel the running command after a Ctrl-C (only
+//while its response is awaited); the reply to the request is one more
+//response to read
+//returns 0 on success or when there was nothing to do, -1 on failure
+static int send_cancel_if_interrupted(int sockfd)
+{
+    int sent;
+
+    if (!g_interrupted)
+    {
+        return 0;
+    }
+
+    g_interrupted = 0;
+
+    if (!g_awaiting)
+    {
+        return 0;
+    }
+
+    if (g_proto == PROTO_FRAMED)
+    {
+        sent = send_command_frame(sockfd, "cancel", strlen("cancel"));
+    }
+    else
+    {
+        sent = send_all(sockfd, "cancel\n", strlen("cancel\n"));
+    }
+
+    if (sent < 0)
+    {
+        return -1;
+    }
+
+    g_extra_responses++;
+    return 0;
+}
+
+//reporting why recv() stopped returning data
+static void report_recv_failure(ssize_t bytes_received)
+{
+    if (bytes_received == 0)
+    {
+        //server closed connection unexpectedly while waiting for response
+        fprintf(stderr, "Server disconnected.\n");
+    }
+    else if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        fprintf(stderr, "Server is not responding. Make sure the server is running and using the same port.\n");
+    }
+    else
+    {
+        perror("recv");
+    }
+}
+
+//receiving exactly length bytes (frame headers and negotiation replies)
+//returns 0 on success, -1 on socket/error conditions
+static int recv_exact(int sockfd, void *buffer, size_t length)
+{
+    size_t received = 0;
+
+    while (received < length)
+    {
+        ssize_t bytes_received = recv(sockfd, (char *)buffer + received, length - received, 0);
+
+        if (bytes_received < 0 && errno == EINTR)
+        {
+            if (send_cancel_if_interrupted(sockfd) < 0)
+            {
+                return -1;
+            }
+
+            continue;
+        }
+
+        if (bytes_received <= 0)
+        {
+            report_recv_failure(bytes_received);
+            return -1;
+        }
+
+        received += (size_t)bytes_received;
+    }
+
+    return 0;
+}
+
+//offering the framed protocol right after connecting
+//returns PROTO_FRAMED when the server accepted, PROTO_TEXT when it answered
+//like an old server (plain END_MARKER), -1 on socket/error conditions
+static int negotiate_protocol(int sockfd)
+{
+    unsigned char reply[FRAME_HEADER_SIZE];
+    size_t marker_len = strlen(END_MARKER);
+    FrameHeader header;
+
+    if (send_all(sockfd, PROTO_HELLO "\n", strlen(PROTO_HELLO "\n")) < 0)
+    {
+        return -1;
+    }
+
+    //an old server runs the hello line as an (empty) shell comment
+    if (recv_exact(sockfd, reply, marker_len) < 0)
+    {
+        return -1;
+    }
+
+    if (memcmp(reply, END_MARKER, marker_len) == 0)
+    {
+        return PROTO_TEXT;
+    }
+
+    if (recv_exact(sockfd, reply + marker_len, sizeof(reply) - marker_len) < 0)
+    {
+        return -1;
+    }
+
+    if (frame_decode(reply, &header) < 0 || header.type != FRAME_HELLO)
+    {
+        fprintf(stderr, "Server speaks an unsupported protocol version.\n");
+        return -1;
+    }
+
+    return PROTO_FRAMED;
+}
+
+//receiving framed output until the FRAME_END frame of the response (and of
+//the replies owed to cancel requests)
+//every chunk is written straight to stdout, so the cost per chunk is O(1)
+//returns 0 on success, -1 on socket/error conditions
+static int receive_framed_response(int sockfd)
+{
+    char chunk[BUFFER_SIZE];
+
+    while (1)
+    {
+        unsigned char encoded[FRAME_HEADER_SIZE];
+        FrameHeader header;
+        size_t remaining;
+
+        if (recv_exact(sockfd, encoded, sizeof(encoded)) < 0)
+        {
+            return -1;
+        }
+
+        if (frame_decode(encoded, &header) < 0)
+        {
+            fprintf(stderr, "Malformed frame from server.\n");
+            return -1;
+        }
+
+        remaining = header.length;
+
+        while (remaining > 0)
+        {
+            size_t want = remaining < sizeof(chunk) ? remaining : sizeof(chunk);
+
+            if (recv_exact(sockfd, chunk, want) < 0)
+            {
+                return -1;
+            }
+
+            if (header.type == FRAME_OUTPUT)
+            {
+                fwrite(chunk, 1, want, stdout);
+            }
+
+            remaining -= want;
+        }
+
+        if (header.type == FRAME_END)
+        {
+            fflush(stdout);
+
+            if (g_extra_responses == 0)
+            {
+                return 0;
+            }
+
+            g_extra_responses--;
+        }
+    }
+}
+
+//receiving full server response until END_MARKER appears (text protocol),
+//then one more per reply owed to cancel requests
+//this function handles partial recv() calls and marker splits across packets;
+//only the newly received bytes (plus a marker-sized overlap) are searched
 //returns 0 on success, -1 on socket/error conditions
 static int receive_response_until_end(int sockfd)
 {
@@ -107,25 +336,23 @@ static int receive_response_until_end(int sockfd)
     while (1)
     {
         ssize_t bytes_received = recv(sockfd, chunk, sizeof(chunk) - 1, 0);
+        size_t search_from;
+        char *marker_pos;
 
-        if (bytes_received < 0)
+        if (bytes_received < 0 && errno == EINTR)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            if (send_cancel_if_interrupted(sockfd) < 0)
             {
-                fprintf(stderr, "Server is not responding. Make sure the server is running and using the same port.\n");
                 free(response);
                 return -1;
             }
 
-            perror("recv");
-            free(response);
-            return -1;
+            continue;
         }
 
-        if (bytes_received == 0)
+        if (bytes_received <= 0)
         {
-            //server closed connection unexpectedly while waiting for response
-            fprintf(stderr, "Server disconnected.\n");
+            report_recv_failure(bytes_received);
             free(response);
             return -1;
         }
@@ -149,28 +376,38 @@ static int receive_response_until_end(int sockfd)
             response = grown;
         }
 
+        //the marker may straddle the previous chunk, so back up marker_len - 1
+        search_from = (used >= marker_len - 1) ? used - (marker_len - 1) : 0;
+
         //appending newly received bytes to accumulated response
         memcpy(response + used, chunk, (size_t)bytes_received);
         used += (size_t)bytes_received;
         response[used] = '\0';
 
-        //checking if END_MARKER already arrived in the accumulated buffer
-        char *marker_pos = strstr(response, END_MARKER);
-        if (marker_pos != NULL)
+        //checking if END_MARKER arrived in the new tail of the buffer
+        marker_pos = memmem(response + search_from, used - search_from, END_MARKER, marker_len);
+        while (marker_pos != NULL)
         {
+            size_t rest;
+
             //truncating marker so client prints only command output
             *marker_pos = '\0';
             printf("%s", response);
             fflush(stdout);
-            free(response);
-            return 0;
-        }
 
-        //minor optimization: if very small response and no marker yet,
-        //continue reading additional chunks
-        if (used < marker_len)
-        {
-            continue;
+            if (g_extra_responses == 0)
+            {
+                free(response);
+                return 0;
+            }
+
+            //another response follows: keeping what came after the marker
+            g_extra_responses--;
+            rest = used - (size_t)(marker_pos + marker_len - response);
+            memmove(response, marker_pos + marker_len, rest);
+            used = rest;
+            response[used] = '\0';
+            marker_pos = memmem(response, used, END_MARKER, marker_len);
         }
     }
 }
@@ -182,7 +419,10 @@ int main(int argc, char **argv)
     const char *env_port;
     struct timeval timeout;
     struct sockaddr_in server_addr;
-    char input_buffer[BUFFER_SIZE];
+    struct sigaction interrupt;
+    char *input_buffer = NULL;
+    size_t input_capacity = 0;
+    int proto;
 
     if (argc > 2)
     {
@@ -209,6 +449,13 @@ int main(int argc, char **argv)
         }
     }
 
+    //Ctrl-C cancels the running command instead of ending the client; no
+    //SA_RESTART, so a waiting recv() returns and can send the request
+    memset(&interrupt, 0, sizeof(interrupt));
+    interrupt.sa_handler = handle_sigint;
+    sigemptyset(&interrupt.sa_mask);
+    sigaction(SIGINT, &interrupt, NULL);
+
     //creating TCP socket for client-server communication
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0)
@@ -250,23 +497,69 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    //offering the framed protocol; old servers keep us on the text protocol
+    proto = negotiate_protocol(sockfd);
+    if (proto < 0)
+    {
+        close(sockfd);
+        return 1;
+    }
+
+    g_proto = proto;
+
     //main client loop: prompt -> read input -> send -> receive -> display
     while (1)
     {
+        ssize_t input_length;
+        int sent;
+
         //displaying prompt similar to regular shell
         printf("$ ");
         fflush(stdout);
 
-        //reading user input from stdin
-        if (fgets(input_buffer, sizeof(input_buffer), stdin) == NULL)
+        //reading user input from stdin (any length)
+        input_length = getline(&input_buffer, &input_capacity, stdin);
+
+        //Ctrl-C at the prompt just starts a fresh line
+        if (input_length < 0 && g_interrupted && !feof(stdin))
+        {
+            g_interrupted = 0;
+            clearerr(stdin);
+            printf("\n");
+            continue;
+        }
+
+        if (input_length < 0)
         {
             //EOF (Ctrl+D) or input stream closed
             printf("\n");
             break;
         }
 
-        //sending full command (including newline) to server
-        if (send_all(sockfd, input_buffer, strlen(input_buffer)) < 0)
+        //sending the command: a whole line in text mode, a frame otherwise
+        if (proto == PROTO_FRAMED)
+        {
+            size_t command_length = (size_t)input_length;
+
+            if (command_length > 0 && input_buffer[command_length - 1] == '\n')
+            {
+                command_length--;
+            }
+
+            if (command_length > PROTO_MAX_COMMAND)
+            {
+                fprintf(stderr, "Command too long (maximum %d bytes).\n", PROTO_MAX_COMMAND);
+                continue;
+            }
+
+            sent = send_command_frame(sockfd, input_buffer, command_length);
+        }
+        else
+        {
+            sent = send_all(sockfd, input_buffer, (size_t)input_length);
+        }
+
+        if (sent < 0)
         {
             break;
         }
@@ -278,13 +571,30 @@ int main(int argc, char **argv)
             break;
         }
 
-        //receiving full command output until protocol END_MARKER
-        if (receive_response_until_end(sockfd) < 0)
+        //receiving full command output until the end of the response; a
+        //Ctrl-C meanwhile cancels the command
+        g_awaiting = 1;
+        g_interrupted = 0;
+
+        if (proto == PROTO_FRAMED)
+        {
+            sent = receive_framed_response(sockfd);
+        }
+        else
+        {
+            sent = receive_response_until_end(sockfd);
+        }
+
+        g_awaiting = 0;
+
+        if (sent < 0)
         {
             break;
         }
     }
 
+    free(input_buffer);
+
     //closing socket before termination
     close(sockfd);
     return 0;
@@ -0,0 +1,721 @@
+#include "dag.h"
+#include "scheduler.h"
+#include "quantum_controller.h"
+#include "timer_wheel.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//running node table buckets (by task id)
+#define DAG_BUCKETS 256
+
+//longest node name (terminator included)
+#define DAG_NAME_MAX 32
+
+typedef enum
+{
+    NODE_WAITING,      //a dependency has not ended yet
+    NODE_RUNNING,      //submitted as a task
+    NODE_SUCCEEDED,
+    NODE_FAILED,       //nonzero exit (timed out and cancelled included)
+    NODE_SKIPPED       //a dependency did not succeed
+} NodeState;
+
+typedef struct
+{
+    char name[DAG_NAME_MAX];
+    char *command;
+    uint64_t deps;             //bit i: depends on node i
+    NodeState state;
+    int task_id;               //its task once submitted
+    int exit_status;
+    uint64_t served_ns;        //service its task received
+} DagNode;
+
+typedef struct Dag
+{
+    //copy of the submitting session, for creating node tasks and replying
+    ClientContext ctx;
+
+    //set once the client disconnected (under mutex, so a node submitted
+    //before it is already queued for the disconnect's cancellation)
+    int gone;
+
+    int node_count;
+    int unfinished;            //nodes not succeeded, failed or skipped yet
+    uint64_t submitted_ns;
+    DagNode nodes[DAG_MAX_NODES];
+
+    //node indexes in dependency order (each after all it depends on)
+    int order[DAG_MAX_NODES];
+
+    //serializes the DAG's results, submissions and replies
+    pthread_mutex_t mutex;
+
+    struct Dag *next;
+} Dag;
+
+//a submitted node, found by its task id when the task ends
+typedef struct DagLink
+{
+    int task_id;
+    Dag *dag;
+    int node;
+    struct DagLink *next;
+} DagLink;
+
+static DagLink *g_links[DAG_BUCKETS];
+static Dag *g_dags = NULL;
+
+//DAGs in flight; task ends skip the table while there are none
+static int g_dag_count = 0;
+
+//guards g_dags; taken around a DAG's mutex, never inside it
+static pthread_mutex_t dag_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//guards g_links; taken inside a DAG's mutex, nothing is locked inside it
+static pthread_mutex_t link_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* ---------- parsing ---------- */
+static char *trim(char *text)
+{
+    char *end;
+
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    end = text + strlen(text);
+
+    while (end > text && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+
+    *end = '\0';
+
+    return text;
+}
+
+static int is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '.';
+}
+
+//returns the index of the node called name, -1 when there is none
+static int find_node(const Dag *dag, const char *name)
+{
+    for (int i = 0; i < dag->node_count; i++)
+    {
+        if (strcmp(dag->nodes[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+//splitting off the next node text at ";;" or a newline
+//returns the rest after the separator, null after the last node
+static char *split_node(char *text)
+{
+    char *pair = strstr(text, ";;");
+    char *newline = strchr(text, '\n');
+
+    if (newline != NULL && (pair == NULL || newline < pair))
+    {
+        *newline = '\0';
+        return newline + 1;
+    }
+
+    if (pair != NULL)
+    {
+        *pair = '\0';
+        return pair + 2;
+    }
+
+    return NULL;
+}
+
+//parsing "name[(deps)] = command" into the next node; the dependency list
+//is kept in *deps_text until every name is known
+//returns 0 on success, -1 with error filled
+static int parse_node(Dag *dag, char *text, char **deps_text, char *error, size_t error_size)
+{
+    DagNode *node = &dag->nodes[dag->node_count];
+    char *equals = strchr(text, '=');
+    char *head;
+    char *name_end;
+    char saved;
+
+    if (equals == NULL)
+    {
+        snprintf(error, error_size, "expected \"name = command\" in \"%.40s\"", trim(text));
+        return -1;
+    }
+
+    *equals = '\0';
+    head = trim(text);
+    name_end = head;
+
+    while (is_name_char(*name_end))
+    {
+        name_end++;
+    }
+
+    if (name_end == head || name_end - head >= DAG_NAME_MAX)
+    {
+        snprintf(error, error_size, "bad node name \"%.40s\"", head);
+        return -1;
+    }
+
+    saved = *name_end;
+    *name_end = '\0';
+
+    if (find_node(dag, head) >= 0)
+    {
+        snprintf(error, error_size, "node %s defined twice", head);
+        return -1;
+    }
+
+    strcpy(node->name, head);
+    *name_end = saved;
+
+    //an optional "(a, b)" naming what the node waits for
+    head = trim(name_end);
+    *deps_text = NULL;
+
+    if (*head == '(' && head[strlen(head) - 1] == ')')
+    {
+        head[strlen(head) - 1] = '\0';
+        *deps_text = head + 1;
+    }
+    else if (*head != '\0')
+    {
+        snprintf(error, error_size, "bad dependency list for %s", node->name);
+        return -1;
+    }
+
+    head = trim(equals + 1);
+
+    if (*head == '\0')
+    {
+        snprintf(error, error_size, "node %s has no command", node->name);
+        return -1;
+    }
+
+    node->command = strdup(head);
+
+    if (node->command == NULL)
+    {
+        snprintf(error, error_size, "out of memory");
+        return -1;
+    }
+
+    dag->node_count++;
+
+    return 0;
+}
+
+//turning dependency names into bits and ordering the nodes so each comes
+//after everything it depends on
+//returns 0 on success, -1 (unknown name or a cycle) with error filled
+static int resolve_dependencies(Dag *dag, char **deps_text, char *error, size_t error_size)
+{
+    uint64_t placed = 0;
+
+    for (int i = 0; i < dag->node_count; i++)
+    {
+        char *save = NULL;
+
+        if (deps_text[i] == NULL)
+        {
+            continue;
+        }
+
+        for (char *name = strtok_r(deps_text[i], ", \t", &save); name != NULL;
+             name = strtok_r(NULL, ", \t", &save))
+        {
+            int dep = find_node(dag, name);
+
+            if (dep < 0)
+            {
+                snprintf(error, error_size, "%s depends on unknown node %.32s",
+                         dag->nodes[i].name, name);
+                return -1;
+            }
+
+            dag->nodes[i].deps |= (uint64_t)1 << dep;
+        }
+    }
+
+    //repeatedly placing a node whose dependencies are all placed: O(n^2)
+    //for at most DAG_MAX_NODES nodes
+    for (int n = 0; n < dag->node_count; n++)
+    {
+        int next = -1;
+
+        for (int i = 0; i < dag->node_count && next < 0; i++)
+        {
+            if (!(placed & ((uint64_t)1 << i)) && (dag->nodes[i].deps & ~placed) == 0)
+            {
+                next = i;
+            }
+        }
+
+        if (next < 0)
+        {
+            snprintf(error, error_size, "dependency cycle");
+            return -1;
+        }
+
+        dag->order[n] = next;
+        placed |= (uint64_t)1 << next;
+    }
+
+    return 0;
+}
+
+//returns the number of nodes parsed, -1 with error filled
+static int parse_dag(Dag *dag, char *spec, char *error, size_t error_size)
+{
+    char *deps_text[DAG_MAX_NODES];
+    char *next;
+
+    for (char *part = spec; part != NULL; part = next)
+    {
+        next = split_node(part);
+
+        if (*trim(part) == '\0')
+        {
+            continue;
+        }
+
+        if (dag->node_count == DAG_MAX_NODES)
+        {
+            snprintf(error, error_size, "more than %d nodes", DAG_MAX_NODES);
+            return -1;
+        }
+
+        if (parse_node(dag, part, &deps_text[dag->node_count], error, error_size) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (dag->node_count == 0)
+    {
+        snprintf(error, error_size, "no nodes");
+        return -1;
+    }
+
+    return resolve_dependencies(dag, deps_text, error, error_size) < 0 ? -1 : dag->node_count;
+}
+
+/* ---------- running ---------- */
+//sending a result line to the client unless it is gone, as one frame
+//under the client's send lock (caller holds dag->mutex)
+static void dag_reply(Dag *dag, int task_id, const char *text)
+{
+    if (!dag->gone)
+    {
+        send_client_output(dag->ctx.client_fd, dag->ctx.proto, task_id, text, strlen(text));
+    }
+}
+
+//submitting a node whose dependencies all succeeded (caller holds
+//dag->mutex)
+//returns 0 on success, -1 when it could not become a task
+static int dag_launch(Dag *dag, int index)
+{
+    DagNode *node = &dag->nodes[index];
+    DagLink *link = (DagLink *)malloc(sizeof(DagLink));
+    Task *task = link != NULL ? create_task_from_command(&dag->ctx, node->command) : NULL;
+    unsigned int bucket;
+
+    if (task == NULL)
+    {
+        free(link);
+        return -1;
+    }
+
+    node->state = NODE_RUNNING;
+    node->task_id = task->task_id;
+
+    link->task_id = task->task_id;
+    link->dag = dag;
+    link->node = index;
+    bucket = (unsigned int)task->task_id % DAG_BUCKETS;
+
+    //registered first: the task may end as soon as it is queued
+    pthread_mutex_lock(&link_mutex);
+    link->next = g_links[bucket];
+    g_links[bucket] = link;
+    pthread_mutex_unlock(&link_mutex);
+
+    log_printf_locked("(%d)--- created (%d)\n", task->client_id, task->burst_time);
+    quantum_note_arrival();
+
+    if (enqueue_task(task) < 0)
+    {
+        //never queued, so nothing else can have found its link
+        pthread_mutex_lock(&link_mutex);
+
+        for (DagLink **at = &g_links[bucket]; *at != NULL; at = &(*at)->next)
+        {
+            if (*at == link)
+            {
+                *at = link->next;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&link_mutex);
+
+        free(link);
+        free_task(task);
+        return -1;
+    }
+
+    return 0;
+}
+
+//one pass in dependency order after nodes ended: a node whose dependency
+//did not succeed is skipped, one whose dependencies all succeeded is
+//submitted (nothing is once the client is gone) (caller holds dag->mutex)
+static void dag_advance(Dag *dag)
+{
+    for (int n = 0; n < dag->node_count; n++)
+    {
+        DagNode *node = &dag->nodes[dag->order[n]];
+        int blocked = 0;
+        int failed = -1;
+        char line[128];
+
+        if (node->state != NODE_WAITING)
+        {
+            continue;
+        }
+
+        for (int i = 0; i < dag->node_count; i++)
+        {
+            if (!(node->deps & ((uint64_t)1 << i)))
+            {
+                continue;
+            }
+
+            if (dag->nodes[i].state == NODE_FAILED || dag->nodes[i].state == NODE_SKIPPED)
+            {
+                failed = i;
+            }
+            else if (dag->nodes[i].state != NODE_SUCCEEDED)
+            {
+                blocked = 1;
+            }
+        }
+
+        if (failed >= 0 || dag->gone)
+        {
+            node->state = NODE_SKIPPED;
+            dag->unfinished--;
+
+            if (failed >= 0)
+            {
+                snprintf(line, sizeof(line), "[dag] %s: skipped (%s did not succeed)\n",
+                         node->name, dag->nodes[failed].name);
+                dag_reply(dag, 0, line);
+            }
+        }
+        else if (!blocked && dag_launch(dag, dag->order[n]) < 0)
+        {
+            node->state = NODE_FAILED;
+            node->exit_status = 1;
+            dag->unfinished--;
+
+            snprintf(line, sizeof(line), "[dag] %s: could not be queued\n", node->name);
+            dag_reply(dag, 0, line);
+        }
+    }
+}
+
+//the summary once every node ended: outcome counts, the critical path (the
+//chain of dependencies with the most service), the makespan and the total
+//work; then the end of the response (status 0 only when every node
+//succeeded) (caller holds dag->mutex, then retires the DAG)
+static void dag_finish(Dag *dag)
+{
+    uint64_t chain_ns[DAG_MAX_NODES];
+    int previous[DAG_MAX_NODES];
+    int counts[NODE_SKIPPED + 1] = {0};
+    uint64_t work_ns = 0;
+    uint64_t makespan_ns = timer_now_ns() - dag->submitted_ns;
+    int last = dag->order[0];
+    int path[DAG_MAX_NODES];
+    int path_len = 0;
+    char summary[4096];
+    int len;
+
+    for (int n = 0; n < dag->node_count; n++)
+    {
+        int i = dag->order[n];
+        uint64_t longest = 0;
+
+        previous[i] = -1;
+
+        for (int d = 0; d < dag->node_count; d++)
+        {
+            if ((dag->nodes[i].deps & ((uint64_t)1 << d)) && chain_ns[d] > longest)
+            {
+                longest = chain_ns[d];
+                previous[i] = d;
+            }
+        }
+
+        chain_ns[i] = longest + dag->nodes[i].served_ns;
+        work_ns += dag->nodes[i].served_ns;
+        counts[dag->nodes[i].state]++;
+
+        if (chain_ns[i] > chain_ns[last])
+        {
+            last = i;
+        }
+    }
+
+    for (int i = last; i >= 0; i = previous[i])
+    {
+        path[path_len++] = i;
+    }
+
+    len = snprintf(summary, sizeof(summary),
+                   "[dag] %d nodes: %d succeeded, %d failed, %d skipped | critical path %.1f ms (",
+                   dag->node_count, counts[NODE_SUCCEEDED], counts[NODE_FAILED],
+                   counts[NODE_SKIPPED], chain_ns[last] / 1e6);
+
+    for (int k = path_len - 1; k >= 0 && len < (int)sizeof(summary); k--)
+    {
+        len += snprintf(summary + len, sizeof(summary) - (size_t)len, "%s%s",
+                        dag->nodes[path[k]].name, k > 0 ? " -> " : "");
+    }
+
+    if (len < (int)sizeof(summary))
+    {
+        snprintf(summary + len, sizeof(summary) - (size_t)len,
+                 ") | makespan %.1f ms | work %.1f ms\n", makespan_ns / 1e6, work_ns / 1e6);
+    }
+
+    //the summary and the end of the response go out back to back; the
+    //socket of a gone client may already be closed and reused
+    if (!dag->gone)
+    {
+        client_send_lock(dag->ctx.client_fd);
+
+        dag_reply(dag, 0, summary);
+        send_client_end(dag->ctx.client_fd, dag->ctx.proto, 0,
+                        counts[NODE_SUCCEEDED] == dag->node_count ? 0 : 1);
+
+        client_send_unlock(dag->ctx.client_fd);
+    }
+
+    log_printf_locked(
+        "[INFO] Client #%d DAG of %d nodes done: critical path %.1f ms, makespan %.1f ms.\n",
+        dag->ctx.client_id,
+        dag->node_count,
+        chain_ns[last] / 1e6,
+        makespan_ns / 1e6);
+}
+
+static void dag_free(Dag *dag)
+{
+    for (int i = 0; i < dag->node_count; i++)
+    {
+        free(dag->nodes[i].command);
+    }
+
+    pthread_mutex_destroy(&dag->mutex);
+    free(dag);
+}
+
+//taking a finished DAG off the active list and freeing it (called with
+//dag->mutex released: dag_client_gone may still be waiting for it)
+static void dag_retire(Dag *dag)
+{
+    pthread_mutex_lock(&dag_mutex);
+
+    for (Dag **link = &g_dags; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == dag)
+        {
+            *link = dag->next;
+            break;
+        }
+    }
+
+    __atomic_sub_fetch(&g_dag_count, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&dag_mutex);
+
+    dag_free(dag);
+}
+
+int dag_submit(ClientContext *ctx, char *spec)
+{
+    Dag *dag = (Dag *)calloc(1, sizeof(Dag));
+    char error[160];
+    int finished;
+
+    if (dag == NULL)
+    {
+        const char *msg = "Error: could not create DAG\n";
+        send_client_output(ctx->client_fd, ctx->proto, 0, msg, strlen(msg));
+        send_client_end(ctx->client_fd, ctx->proto, 0, 1);
+        return 0;
+    }
+
+    pthread_mutex_init(&dag->mutex, NULL);
+
+    if (parse_dag(dag, spec, error, sizeof(error)) < 0)
+    {
+        char reply[256];
+        int len = snprintf(reply, sizeof(reply),
+                           "dag: %s\nUsage: dag name[(deps)] = command ;; ...\n", error);
+
+        send_client_output(ctx->client_fd, ctx->proto, 0, reply, (size_t)len);
+        send_client_end(ctx->client_fd, ctx->proto, 0, 1);
+        dag_free(dag);
+        return 0;
+    }
+
+    //the node tasks only need the session's address and protocol
+    dag->ctx = *ctx;
+    dag->ctx.recv_buf = NULL;
+    dag->ctx.recv_len = 0;
+    dag->ctx.recv_cap = 0;
+    dag->unfinished = dag->node_count;
+    dag->submitted_ns = timer_now_ns();
+
+    log_printf_locked(
+        "[INFO] Client #%d submitted a DAG of %d nodes.\n",
+        ctx->client_id,
+        dag->node_count);
+
+    pthread_mutex_lock(&dag_mutex);
+    dag->next = g_dags;
+    g_dags = dag;
+    __atomic_add_fetch(&g_dag_count, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dag_mutex);
+
+    pthread_mutex_lock(&dag->mutex);
+
+    //the nodes without dependencies start right away
+    dag_advance(dag);
+
+    finished = dag->unfinished == 0;
+
+    if (finished)
+    {
+        dag_finish(dag);
+    }
+
+    pthread_mutex_unlock(&dag->mutex);
+
+    if (finished)
+    {
+        dag_retire(dag);
+    }
+
+    return 0;
+}
+
+int dag_task_end(Task *task)
+{
+    DagLink **link = &g_links[(unsigned int)task->task_id % DAG_BUCKETS];
+    DagLink *found;
+    DagNode *node;
+    Dag *dag;
+    char line[128];
+    int finished;
+
+    if (__atomic_load_n(&g_dag_count, __ATOMIC_ACQUIRE) == 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&link_mutex);
+
+    while (*link != NULL && (*link)->task_id != task->task_id)
+    {
+        link = &(*link)->next;
+    }
+
+    found = *link;
+
+    if (found != NULL)
+    {
+        *link = found->next;
+    }
+
+    pthread_mutex_unlock(&link_mutex);
+
+    if (found == NULL)
+    {
+        return 0;
+    }
+
+    dag = found->dag;
+    node = &dag->nodes[found->node];
+    free(found);
+
+    pthread_mutex_lock(&dag->mutex);
+
+    node->state = task->exit_status == 0 ? NODE_SUCCEEDED : NODE_FAILED;
+    node->exit_status = task->exit_status;
+    node->served_ns = task->served_ns;
+    dag->unfinished--;
+
+    snprintf(line, sizeof(line), "[dag] %s: exit %d after %.1f ms\n",
+             node->name, node->exit_status, node->served_ns / 1e6);
+    dag_reply(dag, task->task_id, line);
+
+    dag_advance(dag);
+
+    finished = dag->unfinished == 0;
+
+    if (finished)
+    {
+        dag_finish(dag);
+    }
+
+    pthread_mutex_unlock(&dag->mutex);
+
+    if (finished)
+    {
+        dag_retire(dag);
+    }
+
+    return 1;
+}
+
+void dag_client_gone(int client_id)
+{
+    pthread_mutex_lock(&dag_mutex);
+
+    for (Dag *dag = g_dags; dag != NULL; dag = dag->next)
+    {
+        //under the DAG's mutex: a node being submitted right now is queued
+        //before this returns, so the cancellation that follows finds it
+        if (dag->ctx.client_id == client_id)
+        {
+            pthread_mutex_lock(&dag->mutex);
+            dag->gone = 1;
+            pthread_mutex_unlock(&dag->mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&dag_mutex);
+}
@@ -0,0 +1,38 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include "server_shared.h"
+#include "scheduler_queue.h"
+
+//dependency graphs submitted in one request:
+//  dag build = make ;; testA(build) = ./testA ;; testB(build) = ./testB ;;
+//      package(testA, testB) = tar czf out.tgz bin
+//nodes are separated by ";;" (or newlines in a framed payload); a node
+//becomes an ordinary task once every node it depends on succeeded, so
+//independent nodes run side by side on the worker pool. Each node reports
+//a "[dag]" line when it ends (its output streams as usual), a node whose
+//dependency failed is skipped, and the response ends after a summary with
+//the critical path (the longest dependency chain by service received) and
+//the makespan (submission to the last node's end)
+
+//most nodes in one DAG
+#define DAG_MAX_NODES 64
+
+//running a "dag" request from a session (spec: the text after "dag"; it
+//may be modified): the graph is checked and its nodes without
+//dependencies are submitted; a malformed graph is answered with an error
+//returns 0 (the connection stays open)
+int dag_submit(ClientContext *ctx, char *spec);
+
+//seeing a task end (its exit_status and served_ns final): a DAG node's
+//result goes to its DAG, which submits the nodes it unblocked and ends the
+//client's response once every node is done
+//returns 1 when the task was a DAG node (the caller sends no end of
+//response for it), 0 otherwise
+int dag_task_end(Task *task);
+
+//a client disconnected: its DAGs submit nothing more and send nothing; they
+//are freed as their running nodes end (call before its tasks are cancelled)
+void dag_client_gone(int client_id);
+
+#endif
@@ -1,6 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <time.h>
+
+//burning one second of this process's own CPU time: time spent stopped by
+//the scheduler or waiting for a core does not count, so the progress
+//printed matches the service the program actually received
+static void run_one_second(void)
+{
+    struct timespec start;
+    struct timespec now;
+    long long elapsed_ns;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+
+    do
+    {
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        elapsed_ns = (long long)(now.tv_sec - start.tv_sec) * 1000000000LL +
+                     (now.tv_nsec - start.tv_nsec);
+    } while (elapsed_ns < 1000000000LL);
+}
 
 int main(int argc, char *argv[])
 {
@@ -25,7 +44,7 @@ int main(int argc, char *argv[])
 
         if (i < seconds)
         {
-            sleep(1);
+            run_one_second();
         }
     }
 
@@ -3,6 +3,96 @@
 //forward declarations
 static int command_exists(const char *cmd);
 
+//waiting for a child (at once when its exit was already seen), releasing
+//its watch and adding its resource usage to *total
+static void wait_child(pid_t pid, int *status, struct rusage *total)
+{
+  struct rusage usage;
+
+  memset(&usage, 0, sizeof(usage));
+
+  child_collect(pid, 1, status, &usage);
+  child_release(pid);
+
+  timeradd(&total->ru_utime, &usage.ru_utime, &total->ru_utime);
+  timeradd(&total->ru_stime, &usage.ru_stime, &total->ru_stime);
+  total->ru_nvcsw += usage.ru_nvcsw;
+  total->ru_nivcsw += usage.ru_nivcsw;
+  total->ru_inblock += usage.ru_inblock;
+  total->ru_oublock += usage.ru_oublock;
+
+  //peak of the largest child, not a sum
+  if (usage.ru_maxrss > total->ru_maxrss)
+  {
+    total->ru_maxrss = usage.ru_maxrss;
+  }
+}
+
+//reporting what a command's children used on stderr, in the server's
+//"ended" line format; only with MYSHELL_STATS set, so output is unchanged
+static void report_usage(const struct rusage *usage)
+{
+  if (getenv("MYSHELL_STATS") == NULL)
+  {
+    return;
+  }
+
+  fprintf(stderr,
+          "[usage] cpu user=%.3fs sys=%.3fs | maxrss=%ld KB | csw vol=%ld invol=%ld | blocks in=%ld out=%ld\n",
+          usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+          usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+          usage->ru_maxrss,
+          usage->ru_nvcsw, usage->ru_nivcsw,
+          usage->ru_inblock, usage->ru_oublock);
+}
+
+//waiting for every child of a pipeline in the order they exit, all of
+//them watched in one poll; their usage is summed into *total
+static void wait_children(pid_t *pids, int n, struct rusage *total)
+{
+  struct pollfd pfds[MAX_CMDS];
+  int left = n;
+  int status;
+
+  for (int i = 0; i < n; i++)
+  {
+    pfds[i].fd = child_watch_fd(pids[i]);
+    pfds[i].events = POLLIN;
+    pfds[i].revents = 0;
+
+    //an unwatched child is simply waited for below
+    if (pfds[i].fd < 0)
+    {
+      wait_child(pids[i], &status, total);
+      left--;
+    }
+  }
+
+  while (left > 0)
+  {
+    if (poll(pfds, (nfds_t)n, -1) < 0)
+    {
+      if (errno != EINTR)
+      {
+        perror("poll");
+        break;
+      }
+
+      continue;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      if (pfds[i].fd >= 0 && pfds[i].revents != 0)
+      {
+        wait_child(pids[i], &status, total);
+        pfds[i].fd = -1;
+        left--;
+      }
+    }
+  }
+}
+
 //validating parsed command before execution
 //returns 1 if valid, 0 if invalid
 int validate_command(Command *cmd) 
@@ -47,6 +137,7 @@ void execute_command(Command *cmd)
 {
   pid_t pid; //process id
   int status; //exit status of child process
+  struct rusage usage; //resources the child used
   
   //forking process to create child
   switch (pid = fork()) 
@@ -58,6 +149,7 @@ void execute_command(Command *cmd)
       
     case 0:
       //child process - executing command
+      child_manager_child_setup();
       
       //handling input redirection
       if (cmd->input_file != NULL) 
@@ -150,8 +242,11 @@ void execute_command(Command *cmd)
     default:
       //parent process - waiting for child to finish
       
-      //waiting for child process to terminate
-      waitpid(pid, &status, 0);
+      //waiting for child process to terminate (collecting its usage)
+      child_watch(pid);
+      memset(&usage, 0, sizeof(usage));
+      wait_child(pid, &status, &usage);
+      report_usage(&usage);
       
       //checking if child exited normally
       if (WIFEXITED(status)) 
@@ -283,6 +378,7 @@ void execute_pipeline(Pipeline *p)
   }
 
   pid_t pids[MAX_CMDS];
+  struct rusage usage; //resources all children used
 
   //forking and setting up each command in the pipeline
   for (int i = 0; i < n; i++) 
@@ -303,6 +399,7 @@ void execute_pipeline(Pipeline *p)
     if (pid == 0) 
     {
       //child process
+      child_manager_child_setup();
       
       //connecting stdin to previous pipe read end if not first command
       if (i > 0) 
@@ -407,8 +504,9 @@ void execute_pipeline(Pipeline *p)
       _exit(127);
     }
 
-    //parent process - storing child pid
+    //parent process - storing and watching child pid
     pids[i] = pid;
+    child_watch(pid);
   }
 
   //parent closing all pipe file descriptors
@@ -419,10 +517,8 @@ void execute_pipeline(Pipeline *p)
   }
 
   //waiting for all children so prompt returns correctly after pipeline completes
-  for (int i = 0; i < n; i++) 
-  {
-    int status;
-    waitpid(pids[i], &status, 0);
-  }
+  memset(&usage, 0, sizeof(usage));
+  wait_children(pids, n, &usage);
+  report_usage(&usage);
 }
 
@@ -0,0 +1,243 @@
+#include "fair_share.h"
+#include "server_shared.h"
+#include "timer_wheel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+//client table buckets (chained; sessions are few compared to tasks)
+#define FAIR_BUCKETS 256
+
+//think time between a reply and the next command that counts as a person at
+//the keyboard: scripts answer faster, idle sessions slower
+#define INTERACTIVE_MIN_THINK_MS 100
+#define INTERACTIVE_MAX_THINK_MS 5000
+
+typedef struct ClientShare
+{
+    int client_id;
+    uint64_t vruntime;          //ns of service received, offset by start
+    uint64_t service_ns;        //ns of service actually received
+    uint64_t cpu_us;            //CPU time its finished tasks' children used
+    uint64_t wait_total_ms;
+    uint64_t wait_max_ms;
+    int dispatches;             //times one of its tasks left a run queue
+    uint64_t last_submit_ms;    //timer_now_ms of its latest command, 0: none
+    uint64_t last_end_ms;       //and of the latest reply it was sent
+    int interactive;            //commands classified as typed
+    int submits;
+
+    struct ClientShare *next;
+} ClientShare;
+
+static ClientShare *g_clients[FAIR_BUCKETS];
+static uint64_t g_min_vruntime = 0;
+
+static pthread_mutex_t fair_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//finding a client's entry (caller holds fair_mutex)
+static ClientShare *fair_lookup(int client_id)
+{
+    ClientShare *share = g_clients[(unsigned int)client_id % FAIR_BUCKETS];
+
+    while (share != NULL && share->client_id != client_id)
+    {
+        share = share->next;
+    }
+
+    return share;
+}
+
+void fair_client_open(int client_id)
+{
+    ClientShare *share = (ClientShare *)calloc(1, sizeof(ClientShare));
+    unsigned int bucket = (unsigned int)client_id % FAIR_BUCKETS;
+
+    if (share == NULL)
+    {
+        //an untracked client simply always looks like a newcomer
+        return;
+    }
+
+    share->client_id = client_id;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share->vruntime = g_min_vruntime;
+    share->next = g_clients[bucket];
+    g_clients[bucket] = share;
+
+    pthread_mutex_unlock(&fair_mutex);
+}
+
+void fair_client_close(int client_id, int log_stats)
+{
+    ClientShare **link = &g_clients[(unsigned int)client_id % FAIR_BUCKETS];
+    ClientShare *share;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    while (*link != NULL && (*link)->client_id != client_id)
+    {
+        link = &(*link)->next;
+    }
+
+    share = *link;
+
+    if (share != NULL)
+    {
+        *link = share->next;
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+
+    if (share == NULL)
+    {
+        return;
+    }
+
+    if (log_stats)
+    {
+        log_printf_locked(
+            "[WAIT] Client #%d | dispatches=%d | avg wait=%.1f ms | max wait=%llu ms | service=%.1f ms | cpu=%.1f ms | interactive=%d/%d\n",
+            client_id,
+            share->dispatches,
+            share->dispatches ? (double)share->wait_total_ms / share->dispatches : 0.0,
+            (unsigned long long)share->wait_max_ms,
+            share->service_ns / 1e6,
+            share->cpu_us / 1000.0,
+            share->interactive,
+            share->submits);
+    }
+
+    free(share);
+}
+
+uint64_t fair_vruntime(int client_id)
+{
+    ClientShare *share;
+    uint64_t vruntime;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+    vruntime = share != NULL ? share->vruntime : g_min_vruntime;
+
+    pthread_mutex_unlock(&fair_mutex);
+
+    return vruntime;
+}
+
+void fair_advance_min(uint64_t vruntime)
+{
+    pthread_mutex_lock(&fair_mutex);
+
+    if (vruntime > g_min_vruntime)
+    {
+        g_min_vruntime = vruntime;
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+}
+
+void fair_charge(int client_id, uint64_t service_ns)
+{
+    ClientShare *share;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+
+    if (share != NULL)
+    {
+        share->vruntime += service_ns;
+        share->service_ns += service_ns;
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+}
+
+void fair_charge_cpu(int client_id, uint64_t cpu_us)
+{
+    ClientShare *share;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+
+    if (share != NULL)
+    {
+        share->cpu_us += cpu_us;
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+}
+
+void fair_record_wait(int client_id, uint64_t wait_ms)
+{
+    ClientShare *share;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+
+    if (share != NULL)
+    {
+        share->dispatches++;
+        share->wait_total_ms += wait_ms;
+
+        if (wait_ms > share->wait_max_ms)
+        {
+            share->wait_max_ms = wait_ms;
+        }
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+}
+
+int fair_note_submit(int client_id)
+{
+    ClientShare *share;
+    uint64_t now = timer_now_ms();
+    int interactive = 0;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+
+    if (share != NULL)
+    {
+        //the previous command was answered before this one was typed
+        if (share->last_submit_ms != 0 && share->last_end_ms >= share->last_submit_ms)
+        {
+            uint64_t think_ms = now - share->last_end_ms;
+
+            interactive = think_ms >= INTERACTIVE_MIN_THINK_MS &&
+                          think_ms <= INTERACTIVE_MAX_THINK_MS;
+        }
+
+        share->last_submit_ms = now;
+        share->submits++;
+        share->interactive += interactive;
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+
+    return interactive;
+}
+
+void fair_note_end(int client_id)
+{
+    ClientShare *share;
+
+    pthread_mutex_lock(&fair_mutex);
+
+    share = fair_lookup(client_id);
+
+    if (share != NULL)
+    {
+        share->last_end_ms = timer_now_ms();
+    }
+
+    pthread_mutex_unlock(&fair_mutex);
+}
@@ -0,0 +1,43 @@
+#ifndef FAIR_SHARE_H
+#define FAIR_SHARE_H
+
+#include <stdint.h>
+
+//per-client service accounting shared by every executor worker: virtual
+//runtime (CFS-style, in ns of service received) for the fair-share policy,
+//queue wait statistics and the CPU time of finished tasks for the server log,
+//and the think time that tells a person typing from a batch client
+
+//registering a client when its session opens; it starts at the current
+//minimum virtual runtime so a newcomer cannot monopolise the pool
+void fair_client_open(int client_id);
+
+//dropping a client when its session closes, logging its wait statistics
+//first when log_stats is set
+void fair_client_close(int client_id, int log_stats);
+
+//returns the client's virtual runtime (the current minimum when unknown)
+uint64_t fair_vruntime(int client_id);
+
+//raising the floor new clients start from to vruntime (never lowers it)
+void fair_advance_min(uint64_t vruntime);
+
+//charging ns of service to a client
+void fair_charge(int client_id, uint64_t service_ns);
+
+//charging the CPU time (user + system, in us) a finished task's child used
+void fair_charge_cpu(int client_id, uint64_t cpu_us);
+
+//recording how long one of the client's tasks waited in a run queue
+void fair_record_wait(int client_id, uint64_t wait_ms);
+
+//noting a new command from a client
+//returns 1 when it looks typed by a person: the client waited for the reply
+//to its previous command and then thought for a human while (not too short
+//for a script, not too long for an active session), 0 otherwise
+int fair_note_submit(int client_id);
+
+//noting that the reply to one of the client's commands was sent
+void fair_note_end(int client_id);
+
+#endif
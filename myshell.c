@@ -4,6 +4,12 @@ int main(void)
 {
   char input[MAX_INPUT]; //buffer for storing user input
   Command cmd; //structure for storing parsed command
+
+  //setting up asynchronous child reaping before any child is started
+  if (child_manager_init() < 0)
+  {
+    return EXIT_FAILURE;
+  }
   
   //main shell loop - running infinitely until user exits
   while (1) 
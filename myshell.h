@@ -6,8 +6,12 @@
 #include <string.h>   //strcmp(), strlen(), strtok()
 #include <unistd.h>   //fork(), execvp(), dup2()
 #include <sys/wait.h> //wait(), waitpid()
+#include <sys/time.h> //timeradd()
 #include <fcntl.h>    //open(), O_RDONLY, O_WRONLY, O_CREAT, O_TRUNC
 #include <errno.h>    //errno, ENOENT
+#include <poll.h>     //poll()
+
+#include "child_manager.h" //child_watch(), child_collect()
 
 //constants defining limits and shell prompt
 #define MAX_INPUT 1024  //maximum input buffer size
@@ -0,0 +1,41 @@
+#include "protocol.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+
+void frame_encode(const FrameHeader *header, unsigned char *out)
+{
+    uint16_t flags = htons(header->flags);
+    uint32_t task_id = htonl(header->task_id);
+    uint32_t length = htonl(header->length);
+    uint32_t status = htonl((uint32_t)header->status);
+
+    out[0] = header->version;
+    out[1] = header->type;
+    memcpy(out + 2, &flags, sizeof(flags));
+    memcpy(out + 4, &task_id, sizeof(task_id));
+    memcpy(out + 8, &length, sizeof(length));
+    memcpy(out + 12, &status, sizeof(status));
+}
+
+int frame_decode(const unsigned char *in, FrameHeader *header)
+{
+    uint16_t flags;
+    uint32_t task_id;
+    uint32_t length;
+    uint32_t status;
+
+    memcpy(&flags, in + 2, sizeof(flags));
+    memcpy(&task_id, in + 4, sizeof(task_id));
+    memcpy(&length, in + 8, sizeof(length));
+    memcpy(&status, in + 12, sizeof(status));
+
+    header->version = in[0];
+    header->type = in[1];
+    header->flags = ntohs(flags);
+    header->task_id = ntohl(task_id);
+    header->length = ntohl(length);
+    header->status = (int32_t)ntohl(status);
+
+    return (header->version == PROTO_VERSION) ? 0 : -1;
+}
@@ -0,0 +1,55 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//legacy text protocol: newline-terminated commands, responses end with
+//END_MARKER; still the default for clients that never negotiate
+#define END_MARKER "<<END>>"
+
+//framed protocol negotiation: a client sends this as its first line (it is
+//a plain shell comment, so an old server answers it with just END_MARKER and
+//the client stays on the text protocol); a framed-capable server answers
+//with a FRAME_HELLO frame and both sides switch to frames
+#define PROTO_HELLO "#!mshp 1"
+#define PROTO_VERSION 1
+
+//protocol mode of one connection
+#define PROTO_TEXT 0
+#define PROTO_FRAMED 1
+
+//largest command a framed client may submit
+#define PROTO_MAX_COMMAND (1024 * 1024)
+
+//frame types
+typedef enum
+{
+    FRAME_HELLO = 1,   //server -> client: negotiation accepted
+    FRAME_COMMAND = 2, //client -> server: one command, payload is its text
+    FRAME_OUTPUT = 3,  //server -> client: a chunk of command output
+    FRAME_END = 4      //server -> client: response finished, status = exit status
+} FrameType;
+
+//every frame starts with this fixed header (sent big-endian), followed by
+//exactly `length` payload bytes
+#define FRAME_HEADER_SIZE 16
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t type;
+    uint16_t flags;
+    uint32_t task_id;
+    uint32_t length;
+    int32_t status;
+} FrameHeader;
+
+//serializing a header into FRAME_HEADER_SIZE bytes
+void frame_encode(const FrameHeader *header, unsigned char *out);
+
+//parsing FRAME_HEADER_SIZE bytes into a header
+//returns 0 when the version is supported, -1 otherwise
+int frame_decode(const unsigned char *in, FrameHeader *header);
+
+#endif
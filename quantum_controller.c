@@ -0,0 +1,230 @@
+#include "quantum_controller.h"
+#include "server_shared.h"
+#include "timer_wheel.h"
+
+#include <pthread.h>
+
+//bounds of the adaptive quanta, in steps
+#define QUANTUM_MIN_STEPS 1
+#define QUANTUM_MAX_STEPS 10
+
+//how often the controller looks at what it observed
+#define QUANTUM_PERIOD_MS 2000
+
+//weight of the newest completion in the service average, and of the
+//newest period in the depth and arrival rate averages
+#define QUANTUM_SERVICE_ALPHA 0.3
+#define QUANTUM_PERIOD_ALPHA 0.5
+
+static int g_adaptive = 0;
+static int g_workers = 1;
+
+//adaptive step (ms): a third of the fixed first quantum
+static int g_step_ms = QUANTUM_DEFAULT_FIRST_MS / 3;
+
+//read without the lock by every quantum decision (ms)
+static int g_first = QUANTUM_DEFAULT_FIRST_MS;
+static int g_later = QUANTUM_DEFAULT_LATER_MS;
+
+//observations of the current control period
+static uint64_t g_period_start_ms = 0;
+static int g_arrivals = 0;
+static int g_dispatches = 0;
+static long g_waiting_sum = 0;
+
+//smoothed observations: tasks waiting per worker at dispatch, arrivals per
+//second, and the service of finished tasks in ms (<0 until one finished)
+static double g_depth = 0.0;
+static double g_arrival_rate = 0.0;
+static double g_service_ms = -1.0;
+
+static pthread_mutex_t quantum_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void quantum_init(int adaptive, int workers, int first_ms, int later_ms)
+{
+    g_adaptive = adaptive;
+    g_workers = workers > 0 ? workers : 1;
+    g_first = first_ms;
+    g_later = later_ms;
+    g_step_ms = first_ms / 3 > 0 ? first_ms / 3 : 1;
+    g_period_start_ms = timer_now_ms();
+}
+
+int quantum_first(void)
+{
+    return __atomic_load_n(&g_first, __ATOMIC_RELAXED);
+}
+
+int quantum_later(void)
+{
+    return __atomic_load_n(&g_later, __ATOMIC_RELAXED);
+}
+
+
+void quantum_note_completion(uint64_t service_ms)
+{
+    if (!g_adaptive)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&quantum_mutex);
+
+    if (g_service_ms < 0.0)
+    {
+        g_service_ms = (double)service_ms;
+    }
+    else
+    {
+        g_service_ms += QUANTUM_SERVICE_ALPHA * ((double)service_ms - g_service_ms);
+    }
+
+    pthread_mutex_unlock(&quantum_mutex);
+}
+
+//bounding a quantum given in steps and returning it in ms
+static int clamp_quantum(double steps)
+{
+    if (steps < QUANTUM_MIN_STEPS)
+    {
+        steps = QUANTUM_MIN_STEPS;
+    }
+
+    if (steps > QUANTUM_MAX_STEPS)
+    {
+        steps = QUANTUM_MAX_STEPS;
+    }
+
+    return (int)steps * g_step_ms;
+}
+
+//moving a quantum one step towards its target per period (damping)
+static int step_towards(int current, int target)
+{
+    if (target > current)
+    {
+        return current + g_step_ms < target ? current + g_step_ms : target;
+    }
+
+    if (target < current)
+    {
+        return current - g_step_ms > target ? current - g_step_ms : target;
+    }
+
+    return current;
+}
+
+//one control decision over the period that just ended (caller holds
+//quantum_mutex)
+static void quantum_adjust(uint64_t elapsed_ms)
+{
+    double pressure;
+    int first_target;
+    int later_target;
+    int first;
+    int later;
+
+    //a period without dispatches keeps the depth last seen
+    if (g_dispatches > 0)
+    {
+        g_depth += QUANTUM_PERIOD_ALPHA * ((double)g_waiting_sum / g_dispatches - g_depth);
+    }
+
+    g_arrival_rate += QUANTUM_PERIOD_ALPHA * (g_arrivals * 1000.0 / (double)elapsed_ms - g_arrival_rate);
+
+    //tasks a worker can expect to have waiting: those seen at dispatch plus
+    //those arriving during one first quantum
+    pressure = g_depth + g_arrival_rate * (g_first / 1000.0) / g_workers;
+
+    if (pressure < 1.0)
+    {
+        //nobody waits: shorter quanta would only add stops and resumes
+        first_target = clamp_quantum(QUANTUM_MAX_STEPS);
+        later_target = clamp_quantum(QUANTUM_MAX_STEPS);
+    }
+    else if (g_service_ms >= 0.0)
+    {
+        //others wait: every quantum that ends before its task does costs a
+        //rotation and delays that task's completion, so a first run is long
+        //enough for a typical task to finish and a later one gives a task
+        //that outgrew it as much again (QUANTUM_MAX_STEPS still bounds how
+        //long one task can hold a worker)
+        first_target = clamp_quantum(g_service_ms / g_step_ms + 0.999);
+        later_target = clamp_quantum(2.0 * first_target / g_step_ms);
+    }
+    else
+    {
+        //nothing finished yet to size them by
+        first_target = g_first;
+        later_target = g_later;
+    }
+
+    first = step_towards(g_first, first_target);
+    later = step_towards(g_later, later_target);
+
+    if (first != g_first || later != g_later)
+    {
+        log_printf_locked(
+            "[QUANTUM] first %d->%d ms | later %d->%d ms | depth=%.2f | arrivals=%.2f/s | service=%.1f ms\n",
+            g_first,
+            first,
+            g_later,
+            later,
+            g_depth,
+            g_arrival_rate,
+            g_service_ms < 0.0 ? 0.0 : g_service_ms);
+
+        __atomic_store_n(&g_first, first, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_later, later, __ATOMIC_RELAXED);
+    }
+}
+
+//closing the control period once it has lasted long enough (caller holds
+//quantum_mutex)
+static void quantum_tick(void)
+{
+    uint64_t now = timer_now_ms();
+
+    if (now - g_period_start_ms < QUANTUM_PERIOD_MS)
+    {
+        return;
+    }
+
+    quantum_adjust(now - g_period_start_ms);
+
+    g_period_start_ms = now;
+    g_arrivals = 0;
+    g_dispatches = 0;
+    g_waiting_sum = 0;
+}
+
+void quantum_note_arrival(void)
+{
+    if (!g_adaptive)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&quantum_mutex);
+
+    g_arrivals++;
+    quantum_tick();
+
+    pthread_mutex_unlock(&quantum_mutex);
+}
+
+void quantum_note_dispatch(int waiting)
+{
+    if (!g_adaptive)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&quantum_mutex);
+
+    g_dispatches++;
+    g_waiting_sum += waiting;
+    quantum_tick();
+
+    pthread_mutex_unlock(&quantum_mutex);
+}
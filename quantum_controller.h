@@ -0,0 +1,37 @@
+#ifndef QUANTUM_CONTROLLER_H
+#define QUANTUM_CONTROLLER_H
+
+#include <stdint.h>
+
+//the quanta (in ms) a task gets on its first run and on every later one:
+//fixed at 3000 and 7000 or as server -Q sets them (reproducible runs, the
+//default), or adjusted every control period from the queue depth seen at
+//dispatch, the arrival rate and the service finished tasks needed (server
+//-q adaptive); adaptive quanta move in steps of a third of the fixed first
+//quantum, between one and ten such steps
+
+//default fixed quanta
+#define QUANTUM_DEFAULT_FIRST_MS 3000
+#define QUANTUM_DEFAULT_LATER_MS 7000
+
+//choosing the mode, the pool size and the fixed quanta before the workers
+//start
+void quantum_init(int adaptive, int workers, int first_ms, int later_ms);
+
+//returns the quantum for a task's first run (ms)
+int quantum_first(void);
+
+//returns the quantum for every later run (ms)
+int quantum_later(void);
+
+//counting a submitted task; like the dispatch note below it runs the
+//controller (logging any change) once a control period has passed
+void quantum_note_arrival(void);
+
+//sampling how many tasks still wait on a worker that just took one
+void quantum_note_dispatch(int waiting);
+
+//recording the service a finished task received
+void quantum_note_completion(uint64_t service_ms);
+
+#endif
@@ -0,0 +1,427 @@
+#include "reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//shared epoll instance: every I/O thread waits on it, client sockets are
+//registered EPOLLONESHOT so exactly one thread owns a ready client at a time
+static int g_epoll_fd = -1;
+static int g_listen_fd = -1;
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0)
+    {
+        return -1;
+    }
+
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+//arming (or re-arming) a client socket for its next readable edge
+static int reactor_arm_client(ClientContext *ctx, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    ev.data.ptr = ctx;
+
+    return epoll_ctl(g_epoll_fd, op, ctx->client_fd, &ev);
+}
+
+/* ---------- accept ---------- */
+//draining the listen backlog; edge-triggered so we must loop until EAGAIN
+static void reactor_accept_all(void)
+{
+    while (1)
+    {
+        struct sockaddr_in address;
+        socklen_t address_length = sizeof(address);
+        ClientContext *ctx;
+        int client_fd;
+
+        client_fd = accept4(g_listen_fd,
+                            (struct sockaddr *)&address,
+                            &address_length,
+                            SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+
+            return;
+        }
+
+        ctx = session_open(client_fd, &address);
+
+        if (ctx == NULL)
+        {
+            close(client_fd);
+            continue;
+        }
+
+        if (reactor_arm_client(ctx, EPOLL_CTL_ADD) < 0)
+        {
+            perror("epoll_ctl add");
+            session_close(ctx);
+        }
+    }
+}
+
+/* ---------- input framing ---------- */
+//growing the receive buffer to hold `total` bytes plus a terminator
+static int reactor_reserve(ClientContext *ctx, size_t total)
+{
+    size_t capacity;
+    char *grown;
+
+    if (total + 1 <= ctx->recv_cap)
+    {
+        return 0;
+    }
+
+    capacity = ctx->recv_cap ? ctx->recv_cap : 128;
+
+    while (total + 1 > capacity)
+    {
+        capacity *= 2;
+    }
+
+    grown = realloc(ctx->recv_buf, capacity);
+
+    if (grown == NULL)
+    {
+        perror("realloc");
+        return -1;
+    }
+
+    ctx->recv_buf = grown;
+    ctx->recv_cap = capacity;
+
+    return 0;
+}
+
+static int reactor_append_raw(ClientContext *ctx, const char *data, size_t len)
+{
+    if (reactor_reserve(ctx, ctx->recv_len + len) < 0)
+    {
+        return -1;
+    }
+
+    memcpy(ctx->recv_buf + ctx->recv_len, data, len);
+    ctx->recv_len += len;
+    ctx->recv_buf[ctx->recv_len] = '\0';
+
+    return 0;
+}
+
+//appending to the pending text line, keeping at most BUFFER_SIZE - 1 bytes
+//(the text protocol command limit); the rest of an over-long line is dropped
+static int reactor_append_line(ClientContext *ctx, const char *data, size_t len)
+{
+    size_t room;
+
+    if (ctx->discarding)
+    {
+        return 0;
+    }
+
+    room = (BUFFER_SIZE - 1) - ctx->recv_len;
+
+    if (len > room)
+    {
+        len = room;
+        ctx->discarding = 1;
+    }
+
+    return reactor_append_raw(ctx, data, len);
+}
+
+//consuming bytes up to and including the next newline, dispatching the line
+//once it is complete; *used reports how many bytes were taken
+static int reactor_take_line(ClientContext *ctx, const char *data, size_t len, size_t *used)
+{
+    const char *newline = memchr(data, '\n', len);
+    size_t piece = newline ? (size_t)(newline - data) : len;
+
+    *used = newline ? piece + 1 : len;
+
+    if (reactor_append_line(ctx, data, piece) < 0)
+    {
+        return -1;
+    }
+
+    if (newline == NULL)
+    {
+        return 0;
+    }
+
+    //a blank line still needs a terminated (empty) buffer
+    if (reactor_reserve(ctx, 0) < 0)
+    {
+        return -1;
+    }
+
+    ctx->recv_buf[ctx->recv_len] = '\0';
+    ctx->recv_len = 0;
+    ctx->discarding = 0;
+
+    return session_handle_line(ctx, ctx->recv_buf);
+}
+
+//consuming bytes of the current frame: the fixed header first, then exactly
+//`length` payload bytes; complete FRAME_COMMAND frames are dispatched
+static int reactor_take_frame(ClientContext *ctx, const char *data, size_t len, size_t *used)
+{
+    FrameHeader header;
+    size_t need = FRAME_HEADER_SIZE;
+
+    if (ctx->recv_len >= FRAME_HEADER_SIZE)
+    {
+        frame_decode((const unsigned char *)ctx->recv_buf, &header);
+        need += header.length;
+    }
+
+    *used = need - ctx->recv_len;
+
+    if (*used > len)
+    {
+        *used = len;
+    }
+
+    if (reactor_append_raw(ctx, data, *used) < 0)
+    {
+        return -1;
+    }
+
+    if (ctx->recv_len < FRAME_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    if (ctx->recv_len == FRAME_HEADER_SIZE)
+    {
+        if (frame_decode((const unsigned char *)ctx->recv_buf, &header) < 0 ||
+            header.type != FRAME_COMMAND ||
+            header.length > PROTO_MAX_COMMAND)
+        {
+            log_printf_locked("[INFO] Client #%d sent an invalid frame.\n", ctx->client_id);
+            return -1;
+        }
+
+        if (header.length > 0)
+        {
+            return 0;
+        }
+    }
+    else if (ctx->recv_len < FRAME_HEADER_SIZE + header.length)
+    {
+        return 0;
+    }
+
+    ctx->recv_len = 0;
+
+    return session_handle_command(ctx, ctx->recv_buf + FRAME_HEADER_SIZE);
+}
+
+int reactor_frame_input(ClientContext *ctx, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t used = 0;
+        int result;
+
+        //re-checking the mode each time: the negotiation line switches it
+        //and the following bytes of the same chunk are already frames
+        if (ctx->proto == PROTO_FRAMED)
+        {
+            result = reactor_take_frame(ctx, data, len, &used);
+        }
+        else
+        {
+            result = reactor_take_line(ctx, data, len, &used);
+        }
+
+        if (result < 0)
+        {
+            return -1;
+        }
+
+        data += used;
+        len -= used;
+    }
+
+    return 0;
+}
+
+void reactor_release_idle(ClientContext *ctx)
+{
+    if (ctx->recv_len == 0)
+    {
+        free(ctx->recv_buf);
+        ctx->recv_buf = NULL;
+        ctx->recv_cap = 0;
+    }
+}
+
+//reading until the socket would block
+//returns 0 to keep the connection, -1 to close it
+static int reactor_read_client(ClientContext *ctx)
+{
+    char chunk[BUFFER_SIZE];
+
+    while (1)
+    {
+        ssize_t bytes_received = recv(ctx->client_fd, chunk, sizeof(chunk), 0);
+
+        if (bytes_received < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            perror("recv");
+            return -1;
+        }
+
+        if (bytes_received == 0)
+        {
+            return -1;
+        }
+
+        if (reactor_frame_input(ctx, chunk, (size_t)bytes_received) < 0)
+        {
+            return -1;
+        }
+    }
+
+    reactor_release_idle(ctx);
+
+    return 0;
+}
+
+/* ---------- I/O threads ---------- */
+static void *reactor_io_thread(void *arg)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    (void)arg;
+
+    while (1)
+    {
+        int count = epoll_wait(g_epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            ClientContext *ctx = (ClientContext *)events[i].data.ptr;
+
+            //the listening socket is registered with a null pointer
+            if (ctx == NULL)
+            {
+                reactor_accept_all();
+                continue;
+            }
+
+            if (reactor_read_client(ctx) < 0 ||
+                (events[i].events & EPOLLERR) ||
+                reactor_arm_client(ctx, EPOLL_CTL_MOD) < 0)
+            {
+                epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, ctx->client_fd, NULL);
+                session_close(ctx);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int reactor_run(int server_fd, int io_threads)
+{
+    struct epoll_event ev;
+
+    if (io_threads < 1)
+    {
+        io_threads = 1;
+    }
+
+    g_listen_fd = server_fd;
+
+    if (set_nonblocking(server_fd) < 0)
+    {
+        perror("fcntl");
+        return -1;
+    }
+
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (g_epoll_fd < 0)
+    {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0)
+    {
+        perror("epoll_ctl listen");
+        close(g_epoll_fd);
+        return -1;
+    }
+
+    for (int i = 1; i < io_threads; i++)
+    {
+        pthread_t tid;
+
+        if (pthread_create(&tid, NULL, reactor_io_thread, NULL) != 0)
+        {
+            perror("pthread_create io");
+            break;
+        }
+
+        pthread_detach(tid);
+    }
+
+    reactor_io_thread(NULL);
+
+    close(g_epoll_fd);
+    return -1;
+}
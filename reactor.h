@@ -0,0 +1,27 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "server_shared.h"
+
+//number of epoll I/O threads serving every client connection
+#define REACTOR_IO_THREADS 2
+
+//maximum events handled per epoll_wait call on one I/O thread
+#define REACTOR_MAX_EVENTS 64
+
+//running the edge-triggered epoll event loop on the listening socket
+//spawns io_threads - 1 extra threads and serves on the calling thread too;
+//each I/O thread owns accept, recv and line framing for its ready clients
+//returns -1 only when the loop could not be set up
+int reactor_run(int server_fd, int io_threads);
+
+//splitting received bytes into commands according to the connection's
+//protocol (newline-terminated lines or FRAME_COMMAND frames) and handing
+//each one to the session (shared by the epoll and io_uring backends)
+//returns -1 when the session asked to close the connection
+int reactor_frame_input(ClientContext *ctx, const char *data, size_t len);
+
+//releasing the line buffer between commands to keep idle sessions small
+void reactor_release_idle(ClientContext *ctx);
+
+#endif
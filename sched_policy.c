@@ -0,0 +1,458 @@
+#include "sched_policy.h"
+#include "scheduler.h"
+#include "fair_share.h"
+#include "quantum_controller.h"
+
+#include <string.h>
+
+//round robin quantum (ms)
+#define RR_QUANTUM_MS 3000
+
+//MLFQ levels and their quanta in ms (doubling as a task sinks)
+#define MLFQ_LEVELS 3
+
+static const int mlfq_quanta_ms[MLFQ_LEVELS] = {1000, 2000, 4000};
+
+//fair share: how far (ns of service) a client must be behind the running
+//task's client to preempt it; one slice, so two clients near the same
+//virtual runtime do not take the CPU from each other at every submission
+#define FAIR_PREEMPT_GRANULARITY_NS ((uint64_t)SLICE_MS * 1000000u)
+
+static void stamp_nothing(Task *task)
+{
+    (void)task;
+}
+
+static void keep_level(Task *task, int events)
+{
+    (void)task;
+    (void)events;
+}
+
+static int never_preempt(const Task *new_task, const Task *current)
+{
+    (void)new_task;
+    (void)current;
+
+    return 0;
+}
+
+//taking the heap root: the policy order alone decides
+static Task *pick_heap_root(const TaskHeap *demos, const ClientGroup *groups,
+                            int last_selected_task_id)
+{
+    (void)groups;
+    (void)last_selected_task_id;
+
+    return demos->len > 0 ? demos->items[0] : NULL;
+}
+
+//whole milliseconds of service a task received so far
+static int served_ms(const Task *task)
+{
+    return (int)(task->served_ns / 1000000u);
+}
+
+int sched_policy_boost_left(const Task *task)
+{
+    int served = served_ms(task);
+
+    return task->boost_ms > served ? task->boost_ms - served : 0;
+}
+
+//more interactive boost left first; the boost only shrinks while a task
+//runs, so queued tasks keep their order
+//returns <0 when a comes first, >0 when b does, 0 when the policy decides
+static int boost_compare(const Task *a, const Task *b)
+{
+    return sched_policy_boost_left(b) - sched_policy_boost_left(a);
+}
+
+//wrap-safe comparison of run queue entry order
+static int seq_before(unsigned int a, unsigned int b)
+{
+    return (int)(a - b) < 0;
+}
+
+//shell commands in submission order
+static int shell_fifo_before(const Task *a, const Task *b)
+{
+    int boost = boost_compare(a, b);
+
+    return boost != 0 ? boost < 0 : a->arrival_order < b->arrival_order;
+}
+
+//aging: ms of remaining time forgiven per second a task has been in the
+//system, 0 for pure SJRF
+static int g_aging_ms_per_s = 0;
+
+void sched_policy_set_aging(int ms_per_s)
+{
+    g_aging_ms_per_s = ms_per_s;
+}
+
+/* ---------- sjrf ---------- */
+//expected milliseconds of work left: a demo's remaining slices; a shell
+//command's prediction minus what it got so far, and once it outlived the
+//prediction, at least as much again as it already ran
+static int sjrf_remaining_ms(const Task *task)
+{
+    int served = served_ms(task);
+
+    if (task->type != TASK_SHELL)
+    {
+        return task->remaining_time * SLICE_MS;
+    }
+
+    return task->predicted_ms > served ? task->predicted_ms - served : served;
+}
+
+//comparing remaining times less each task's aging credit (aging rate times
+//the time since its submission); the credit of both grows at the same pace,
+//so their order never changes while they wait and heaps stay valid
+//returns <0 when a comes first, >0 when b does, 0 on a tie
+static int64_t sjrf_compare(const Task *a, const Task *b)
+{
+    int64_t diff = (int64_t)sjrf_remaining_ms(a) - sjrf_remaining_ms(b);
+
+    if (g_aging_ms_per_s > 0)
+    {
+        //the earlier submission has the larger credit (wrap-safe in 32 bits)
+        diff += (int64_t)g_aging_ms_per_s * (int)(a->submitted_ms - b->submitted_ms) / 1000;
+    }
+
+    return diff;
+}
+
+//shorter remaining time first (aged), FCFS among equals
+static int sjrf_before(const Task *a, const Task *b)
+{
+    int boost = boost_compare(a, b);
+    int64_t diff;
+
+    if (boost != 0)
+    {
+        return boost < 0;
+    }
+
+    diff = sjrf_compare(a, b);
+
+    if (diff != 0)
+    {
+        return diff < 0;
+    }
+
+    return a->arrival_order < b->arrival_order;
+}
+
+//shortest predicted runtime first (never-seen commands predict 0), FCFS
+//among equals
+static int sjrf_shell_before(const Task *a, const Task *b)
+{
+    int boost = boost_compare(a, b);
+
+    if (boost != 0)
+    {
+        return boost < 0;
+    }
+
+    if (a->predicted_ms != b->predicted_ms)
+    {
+        return a->predicted_ms < b->predicted_ms;
+    }
+
+    return a->arrival_order < b->arrival_order;
+}
+
+//the heap root, unless it is the task this worker just ran and others
+//wait: then the runner-up, which is the better of the root's two children,
+//so the round robin rule is O(1)
+static Task *sjrf_pick_next(const TaskHeap *demos, const ClientGroup *groups,
+                            int last_selected_task_id)
+{
+    Task *best;
+
+    (void)groups;
+
+    if (demos->len == 0)
+    {
+        return NULL;
+    }
+
+    best = demos->items[0];
+
+    if (best->task_id == last_selected_task_id && demos->len > 1)
+    {
+        best = demos->items[1];
+
+        if (demos->len > 2 && sjrf_before(demos->items[2], best))
+        {
+            best = demos->items[2];
+        }
+    }
+
+    return best;
+}
+
+//the running task keeps its aging credit, so a long task that finally got
+//the worker is not pushed back by every short newcomer
+static int sjrf_should_preempt(const Task *new_task, const Task *current)
+{
+    return sjrf_compare(new_task, current) < 0;
+}
+
+//a task's first run is short so newcomers get an early look (3 s then 7 s,
+//unless configured in ms with server -Q or adapted by the quantum controller)
+static int sjrf_quantum_for(const Task *task)
+{
+    return task->round_count == 0 ? quantum_first() : quantum_later();
+}
+
+const SchedPolicyOps sched_policy_sjrf =
+{
+    "sjrf",
+    0,
+    stamp_nothing,
+    sjrf_before,
+    sjrf_shell_before,
+    sjrf_pick_next,
+    keep_level,
+    sjrf_should_preempt,
+    sjrf_quantum_for
+};
+
+/* ---------- rr ---------- */
+static int rr_before(const Task *a, const Task *b)
+{
+    int boost = boost_compare(a, b);
+
+    return boost != 0 ? boost < 0 : seq_before(a->run_seq, b->run_seq);
+}
+
+static int rr_quantum_for(const Task *task)
+{
+    (void)task;
+
+    return RR_QUANTUM_MS;
+}
+
+const SchedPolicyOps sched_policy_rr =
+{
+    "rr",
+    0,
+    stamp_nothing,
+    rr_before,
+    shell_fifo_before,
+    pick_heap_root,
+    keep_level,
+    never_preempt,
+    rr_quantum_for
+};
+
+/* ---------- mlfq ---------- */
+//higher level first, FIFO within a level
+static int mlfq_before(const Task *a, const Task *b)
+{
+    int boost = boost_compare(a, b);
+
+    if (boost != 0)
+    {
+        return boost < 0;
+    }
+
+    if (a->level != b->level)
+    {
+        return a->level < b->level;
+    }
+
+    return seq_before(a->run_seq, b->run_seq);
+}
+
+//a task that used its whole quantum is CPU bound and sinks one level; one
+//that was preempted keeps its level
+static void mlfq_on_slice_end(Task *task, int events)
+{
+    if ((events & SLICE_QUANTUM) && task->level < MLFQ_LEVELS - 1)
+    {
+        task->level++;
+    }
+}
+
+static int mlfq_should_preempt(const Task *new_task, const Task *current)
+{
+    return new_task->level < current->level;
+}
+
+static int mlfq_quantum_for(const Task *task)
+{
+    return mlfq_quanta_ms[task->level < MLFQ_LEVELS ? task->level : MLFQ_LEVELS - 1];
+}
+
+const SchedPolicyOps sched_policy_mlfq =
+{
+    "mlfq",
+    0,
+    stamp_nothing,
+    mlfq_before,
+    shell_fifo_before,
+    pick_heap_root,
+    mlfq_on_slice_end,
+    mlfq_should_preempt,
+    mlfq_quantum_for
+};
+
+/* ---------- fair ---------- */
+//the shortest task of the client with the least virtual runtime that has
+//work on this run queue, unless another client's head has more interactive
+//boost left; O(clients on the queue)
+static Task *fair_pick_next(const TaskHeap *demos, const ClientGroup *groups,
+                            int last_selected_task_id)
+{
+    const ClientGroup *best_group = NULL;
+    uint64_t best_vruntime = 0;
+
+    (void)demos;
+    (void)last_selected_task_id;
+
+    for (const ClientGroup *group = groups; group != NULL; group = group->next)
+    {
+        uint64_t vruntime = fair_vruntime(group->client_id);
+        int boost = best_group == NULL ? 0
+                  : boost_compare(group->demos.items[0], best_group->demos.items[0]);
+
+        if (best_group == NULL || boost < 0 ||
+            (boost == 0 && vruntime < best_vruntime) ||
+            (boost == 0 && vruntime == best_vruntime &&
+             sjrf_before(group->demos.items[0], best_group->demos.items[0])))
+        {
+            best_group = group;
+            best_vruntime = vruntime;
+        }
+    }
+
+    if (best_group == NULL)
+    {
+        return NULL;
+    }
+
+    //clients arriving later start from the service level being served now
+    //(a pick won by boost may not be the least served one)
+    if (sched_policy_boost_left(best_group->demos.items[0]) == 0)
+    {
+        fair_advance_min(best_vruntime);
+    }
+
+    return best_group->demos.items[0];
+}
+
+//preempting like the pick order: another client's task only when that
+//client is behind the running one's by more than the granularity, a task
+//of the same client when it is shorter (as its group is ordered)
+static int fair_should_preempt(const Task *new_task, const Task *current)
+{
+    if (new_task->client_id == current->client_id)
+    {
+        return sjrf_should_preempt(new_task, current);
+    }
+
+    return fair_vruntime(new_task->client_id) + FAIR_PREEMPT_GRANULARITY_NS <
+           fair_vruntime(current->client_id);
+}
+
+const SchedPolicyOps sched_policy_fair =
+{
+    "fair",
+    1,
+    stamp_nothing,
+    sjrf_before,
+    sjrf_shell_before,
+    fair_pick_next,
+    keep_level,
+    fair_should_preempt,
+    sjrf_quantum_for
+};
+
+/* ---------- edf ---------- */
+//ordering by deadline: the earlier one first, tasks without one after all
+//that have one
+//returns <0, 0 or >0 like a comparator (0: same deadline, or neither has one)
+static int deadline_compare(const Task *a, const Task *b)
+{
+    if (a->deadline_ms == b->deadline_ms)
+    {
+        return 0;
+    }
+
+    if (a->deadline_ms == 0 || b->deadline_ms == 0)
+    {
+        return a->deadline_ms == 0 ? 1 : -1;
+    }
+
+    //wrap-safe: deadlines are kept in 32 bits
+    return (int)(a->deadline_ms - b->deadline_ms) < 0 ? -1 : 1;
+}
+
+//earliest deadline first, SJRF among equal deadlines (a deadline outranks
+//the interactive boost)
+static int edf_before(const Task *a, const Task *b)
+{
+    int order = deadline_compare(a, b);
+
+    return order != 0 ? order < 0 : sjrf_before(a, b);
+}
+
+static int edf_shell_before(const Task *a, const Task *b)
+{
+    int order = deadline_compare(a, b);
+
+    return order != 0 ? order < 0 : sjrf_shell_before(a, b);
+}
+
+//a newcomer due sooner interrupts; among equal deadlines SJRF decides
+static int edf_should_preempt(const Task *new_task, const Task *current)
+{
+    int order = deadline_compare(new_task, current);
+
+    return order != 0 ? order < 0 : sjrf_should_preempt(new_task, current);
+}
+
+const SchedPolicyOps sched_policy_edf =
+{
+    "edf",
+    0,
+    stamp_nothing,
+    edf_before,
+    edf_shell_before,
+    pick_heap_root,
+    keep_level,
+    edf_should_preempt,
+    sjrf_quantum_for
+};
+
+/* ---------- lookup ---------- */
+static const SchedPolicyOps *const g_policies[] =
+{
+    &sched_policy_sjrf,
+    &sched_policy_rr,
+    &sched_policy_mlfq,
+    &sched_policy_fair,
+    &sched_policy_edf
+};
+
+const SchedPolicyOps *sched_policy_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(g_policies) / sizeof(g_policies[0]); i++)
+    {
+        if (strcmp(g_policies[i]->name, name) == 0)
+        {
+            return g_policies[i];
+        }
+    }
+
+    return NULL;
+}
+
+const char *sched_policy_names(void)
+{
+    return "sjrf|rr|mlfq|fair|edf";
+}
@@ -0,0 +1,84 @@
+#ifndef SCHED_POLICY_H
+#define SCHED_POLICY_H
+
+#include "scheduler_queue.h"
+
+//a scheduling policy: how tasks are ordered on a run queue, which demo runs
+//next, for how long, and when a newcomer interrupts the running task
+//shell commands that have not run yet wait ahead of all demos (in the
+//policy's shell order) and preempt a running demo; a shell command stopped
+//after its first quantum is ordered among the demos like one of them
+typedef struct SchedPolicyOps
+{
+    //name accepted by server -p and the policy admin command
+    const char *name;
+
+    //keeping one demo heap per client (fair share) instead of one per queue
+    int per_client;
+
+    //stamping a demo task that has just been added to a run queue
+    void (*on_arrival)(Task *task);
+
+    //run queue order: non-zero when demo a should run before demo b (a
+    //shell command that already ran counts as a demo here)
+    int (*before)(const Task *a, const Task *b);
+
+    //the same for two shell commands that have not run yet
+    int (*shell_before)(const Task *a, const Task *b);
+
+    //choosing the next demo from a run queue's heaps (both ordered by
+    //before); last_selected_task_id is the task this worker ran last
+    //returns null when there is none
+    Task *(*pick_next)(const TaskHeap *demos, const ClientGroup *groups,
+                       int last_selected_task_id);
+
+    //seeing a task leave the CPU unfinished; events is the
+    //SLICE_QUANTUM / SLICE_PREEMPTED mask that ended its run
+    void (*on_slice_end)(Task *task, int events);
+
+    //deciding whether a newly queued task should interrupt the running one
+    int (*should_preempt)(const Task *new_task, const Task *current);
+
+    //returns how many ms the task may run before it is requeued
+    int (*quantum_for)(const Task *task);
+} SchedPolicyOps;
+
+//shortest remaining first with round robin quanta (3 s, then 7 s, or as
+//server -Q sets them or the quantum controller adapts them); shell commands
+//by predicted runtime
+extern const SchedPolicyOps sched_policy_sjrf;
+
+//plain round robin: arrival order, fixed quantum, no preemption
+extern const SchedPolicyOps sched_policy_rr;
+
+//multilevel feedback queue: a task that uses up its quantum drops a level
+extern const SchedPolicyOps sched_policy_mlfq;
+
+//per-client fair share: least-served client first, SJRF within it (shell
+//commands as under sjrf)
+extern const SchedPolicyOps sched_policy_fair;
+
+//earliest deadline first (server -t, "@timeout=N"); tasks without a
+//deadline follow, SJRF breaks ties
+extern const SchedPolicyOps sched_policy_edf;
+
+//service a command typed in an active session runs ahead of batch work for
+#define INTERACTIVE_BOOST_MS 1000
+
+//returns the interactive boost a task has left (its boost less the service
+//it received so far), 0 for batch work; every policy orders tasks with more
+//boost left first and only then by its own rule
+int sched_policy_boost_left(const Task *task);
+
+//setting SJRF aging (sjrf, fair and edf tie-breaks): every second since its
+//submission takes ms_per_s ms off a task's remaining time as far as ordering
+//goes, 0 (the default) for pure SJRF; set before queue_init
+void sched_policy_set_aging(int ms_per_s);
+
+//finding a policy by name; returns null for unknown names
+const SchedPolicyOps *sched_policy_find(const char *name);
+
+//listing every policy name separated by '|' (for usage messages)
+const char *sched_policy_names(void);
+
+#endif
@@ -1,5 +1,8 @@
 #include "scheduler.h"
+#include "sched_policy.h"
 #include "server_shared.h"
+#include "child_manager.h"
+#include "dag.h"
 
 #include <pthread.h>
 #include <stdio.h>
@@ -8,269 +11,898 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <libgen.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+//program run for demo tasks, next to the server binary
+#define DEMO_PROGRAM "demo"
+
+//its full path, resolved once by scheduler_init (the server may be started
+//from any directory)
+static char g_demo_path[PATH_MAX] = "./" DEMO_PROGRAM;
 
 static SchedulerState g_scheduler = {0};
 
 static pthread_mutex_t scheduler_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static int g_preempt_flag = 0;
-static int g_preempting_task_id = -1;
+//a disconnected client waiting for its running tasks to stop before its
+//socket is released (see scheduler_release_client)
+typedef struct ClosingClient
+{
+    int client_id;
+    int client_fd;
+    ClientRelease release;
+    struct ClosingClient *next;
+} ClosingClient;
+
+//guarded by scheduler_mutex
+static ClosingClient *g_closing = NULL;
+
 static char g_trace[4096];
 static size_t g_trace_len = 0;
 
-void scheduler_init(void)
+//set once the kernel refuses pipe -> socket splice; later tasks go straight
+//to the read()/send() path
+static int g_splice_unsupported = 0;
+
+//pointing g_demo_path at the demo program in the server binary's
+//directory; it stays relative to the working directory when that cannot
+//be found out
+static void resolve_demo_path(void)
+{
+    char exe[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+
+    if (len <= 0)
+    {
+        return;
+    }
+
+    exe[len] = '\0';
+
+    if (snprintf(g_demo_path, sizeof(g_demo_path), "%s/%s",
+                 dirname(exe), DEMO_PROGRAM) >= (int)sizeof(g_demo_path))
+    {
+        snprintf(g_demo_path, sizeof(g_demo_path), "./%s", DEMO_PROGRAM);
+    }
+}
+
+int scheduler_init(int workers)
 {
+    resolve_demo_path();
+
     pthread_mutex_lock(&scheduler_mutex);
 
     memset(&g_scheduler, 0, sizeof(SchedulerState));
 
+    g_scheduler.worker_count = workers;
     g_scheduler.round_number = 1;
-    g_scheduler.quantum_size = 3;
-    g_scheduler.current_task = NULL;
-    g_scheduler.quantum_consumed = 0;
-    g_scheduler.last_selected_task_id = -1;
     g_scheduler.total_completed = 0;
+    g_scheduler.total_summarised = 0;
     g_scheduler.total_time_used = 0;
 
-    g_preempt_flag = 0;
-    g_preempting_task_id = -1;
+    for (int i = 0; i < MAX_WORKERS; i++)
+    {
+        g_scheduler.workers[i].current_task = NULL;
+        g_scheduler.workers[i].quantum_consumed = 0;
+        g_scheduler.workers[i].last_selected_task_id = -1;
+        g_scheduler.workers[i].preempt_flag = 0;
+        g_scheduler.workers[i].preempting_task_id = -1;
+        g_scheduler.workers[i].cancel_flag = 0;
+        pthread_mutex_init(&g_scheduler.workers[i].dispatch_mutex, NULL);
+
+        timer_wheel_init(&g_scheduler.workers[i].wheel, timer_now_ms());
+        timer_entry_init(&g_scheduler.workers[i].slice_timer, TIMER_SLICE, NULL);
+        timer_entry_init(&g_scheduler.workers[i].quantum_timer, TIMER_QUANTUM, NULL);
+        timer_entry_init(&g_scheduler.workers[i].deadline_timer, TIMER_DEADLINE, NULL);
+        g_scheduler.workers[i].wake_fd = -1;
+        g_scheduler.workers[i].timer_fd = -1;
+
+        if (i < workers)
+        {
+            g_scheduler.workers[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+            if (g_scheduler.workers[i].wake_fd < 0)
+            {
+                perror("eventfd");
+                pthread_mutex_unlock(&scheduler_mutex);
+                return -1;
+            }
+
+            g_scheduler.workers[i].timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                                             TFD_NONBLOCK | TFD_CLOEXEC);
+
+            if (g_scheduler.workers[i].timer_fd < 0)
+            {
+                perror("timerfd_create");
+                pthread_mutex_unlock(&scheduler_mutex);
+                return -1;
+            }
+        }
+    }
+
     g_trace[0] = '\0';
     g_trace_len = 0;
 
     pthread_mutex_unlock(&scheduler_mutex);
+
+    return 0;
 }
 
-Task *scheduler_select_next_task(void)
+Task *scheduler_select_next_task(int worker)
 {
-    Task *selected_task = NULL;
-    Task *candidate = NULL;
-    Task *temp_queue = NULL;
-    Task *curr = NULL;
-    int queue_size = 0;
+    SchedulerWorker *state = &g_scheduler.workers[worker];
+    Task *selected_task;
 
-    pthread_mutex_lock(&scheduler_mutex);
+    //read-only peek under the run queue's own lock: queue order is left
+    //untouched and no enqueue (hence no preemption check) is triggered
+    selected_task = peek_next_task(worker, state->last_selected_task_id);
 
-    if (queue_is_empty())
+    if (selected_task != NULL)
     {
+        pthread_mutex_lock(&scheduler_mutex);
+        state->last_selected_task_id = selected_task->task_id;
+        state->quantum_consumed = 0;
         pthread_mutex_unlock(&scheduler_mutex);
-        return NULL;
     }
 
-    while (!queue_is_empty())
+    return selected_task;
+}
+
+/* ---------- child output forwarding ---------- */
+//copying length bytes of child output through user space; keeps draining
+//after a send failure so the child never blocks on a full pipe. The rest
+//of a frame whose header already went out (announced) is sent raw
+static void forward_output_copy(Task *task, int pipe_fd, size_t length, int announced)
+{
+    char buffer[BUFFER_SIZE];
+
+    while (length > 0)
     {
-        Task *t = dequeue_task();
+        ssize_t n = read(pipe_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+        int rc;
 
-        if (t == NULL)
+        if (n < 0 && errno == EINTR)
         {
-            break;
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return;
+        }
+
+        if (announced)
+        {
+            rc = send_all(task->client_fd, buffer, (size_t)n);
+        }
+        else
+        {
+            rc = send_client_output(task->client_fd, task->proto, task->task_id,
+                                    buffer, (size_t)n);
         }
 
-        t->next = temp_queue;
-        temp_queue = t;
-        queue_size++;
+        if (rc == 0)
+        {
+            task->bytes_sent += (int)n;
+        }
+
+        length -= (size_t)n;
     }
+}
+
+static int splice_unsupported_errno(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+#define SEND_STALL_MS 1000
 
-    curr = temp_queue;
+//the worker a thread is and the task it runs, set by
+//scheduler_set_current_task for the sends made on the task's behalf
+static __thread int t_send_worker = -1;
+static __thread Task *t_send_task = NULL;
 
-    while (curr != NULL)
+int scheduler_wait_writable(int client_fd)
+{
+    SchedulerWorker *state;
+    Task *task = t_send_task;
+    int killed = 0;
+
+    if (t_send_worker < 0 || task == NULL)
     {
-        Task *next = curr->next;
-        curr->next = NULL;
-        enqueue_task(curr);
-        curr = next;
+        struct pollfd pfd;
+
+        pfd.fd = client_fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, -1);
+        return 0;
     }
 
-    curr = temp_queue;
+    state = &g_scheduler.workers[t_send_worker];
 
-    while (curr != NULL)
+    while (1)
     {
-        if (curr->type == TASK_SHELL && curr->burst_time == -1)
+        struct pollfd pfds[3];
+        int timeout = -1;
+
+        if (scheduler_check_cancel(t_send_worker))
         {
-            selected_task = curr;
             break;
         }
 
-        curr = curr->next;
-    }
-
-    if (selected_task == NULL)
-    {
-        curr = temp_queue;
-
-        while (curr != NULL)
+        //a deadline kills the group on time; the client gets a short grace
+        //to take the output already produced before it is given up
+        if (task->deadline_ms != 0)
         {
-            if (curr->type == TASK_DEMO_PROGRAM || curr->type == TASK_UNKNOWN_PROGRAM)
+            timeout = (int)(task->deadline_ms - (unsigned int)timer_now_ms());
+
+            if (timeout <= 0)
             {
-                if (candidate == NULL)
-                {
-                    candidate = curr;
-                }
-                else if (curr->remaining_time < candidate->remaining_time)
+                if (!killed && task->pid > 0)
                 {
-                    candidate = curr;
+                    kill(-task->pid, SIGKILL);
+                    killed = 1;
                 }
-                else if (curr->remaining_time == candidate->remaining_time &&
-                         curr->arrival_order < candidate->arrival_order)
+
+                timeout += SEND_STALL_MS;
+
+                if (timeout <= 0)
                 {
-                    candidate = curr;
+                    break;
                 }
             }
+        }
 
-            curr = curr->next;
+        pfds[0].fd = client_fd;
+        pfds[0].events = POLLOUT;
+        pfds[0].revents = 0;
+        pfds[1].fd = state->wake_fd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        pfds[2].fd = state->timer_fd;
+        pfds[2].events = POLLIN;
+        pfds[2].revents = 0;
+
+        if (poll(pfds, 3, timeout) < 0)
+        {
+            continue;
         }
 
-        selected_task = candidate;
-    }
+        //an error or hangup is left for the send to report
+        if (pfds[0].revents != 0)
+        {
+            return 0;
+        }
 
-    if (selected_task != NULL && queue_size > 1)
-    {
-        if (selected_task->task_id == g_scheduler.last_selected_task_id)
+        //quantum and preemption events wait for the send: the child is
+        //blocked on its full pipe meanwhile; the run loop re-arms the timer
+        if (pfds[2].revents & POLLIN)
         {
-            candidate = NULL;
-            curr = temp_queue;
+            uint64_t expirations;
 
-            while (curr != NULL)
+            if (read(state->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
             {
-                if (curr->task_id != selected_task->task_id &&
-                    (curr->type == TASK_DEMO_PROGRAM || curr->type == TASK_UNKNOWN_PROGRAM))
-                {
-                    if (candidate == NULL)
-                    {
-                        candidate = curr;
-                    }
-                    else if (curr->remaining_time < candidate->remaining_time)
-                    {
-                        candidate = curr;
-                    }
-                    else if (curr->remaining_time == candidate->remaining_time &&
-                             curr->arrival_order < candidate->arrival_order)
-                    {
-                        candidate = curr;
-                    }
-                }
+                perror("timerfd read");
+            }
+
+            state->timer_fd_expiry_ms = 0;
+        }
+
+        if (pfds[1].revents & POLLIN)
+        {
+            uint64_t count;
 
-                curr = curr->next;
+            if (read(state->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            {
+                perror("eventfd read");
             }
+        }
+    }
+
+    //a frame may be cut short: the stream cannot be trusted any more
+    shutdown(client_fd, SHUT_RDWR);
+    errno = ECANCELED;
+    return -1;
+}
+
+//moving up to length bytes pipe -> socket inside the kernel
+//returns bytes moved, 0 at eof, -1 on error with errno set
+static ssize_t splice_to_client(int pipe_fd, int client_fd, size_t length)
+{
+    while (1)
+    {
+        ssize_t moved = splice(pipe_fd, NULL, client_fd, NULL, length, SPLICE_F_MOVE);
+
+        if (moved >= 0)
+        {
+            return moved;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
 
-            if (candidate != NULL)
+        //the client socket is non-blocking: wait until it drains
+        if (errno == EAGAIN)
+        {
+            if (scheduler_wait_writable(client_fd) < 0)
             {
-                selected_task = candidate;
+                return -1;
             }
+
+            continue;
         }
+
+        return -1;
     }
+}
 
-    if (selected_task != NULL)
+//forwarding length bytes the pipe already holds with splice(): pipe pages
+//go straight into the socket without a user-space copy; framed clients get
+//one FRAME_OUTPUT header for the chunk (its length had to be known first,
+//hence FIONREAD). Falls back to copying once splice is unsupported here.
+//The client's send lock is held for the whole chunk: nothing else sent to
+//the client (another task's output, a DAG line, an end of response) may
+//land inside an announced payload
+static void forward_output_chunk(Task *task, int pipe_fd, size_t length)
+{
+    size_t done = 0;
+    int announced = task->proto == PROTO_FRAMED;
+
+    if (g_splice_unsupported)
     {
-        g_scheduler.last_selected_task_id = selected_task->task_id;
-        g_scheduler.quantum_consumed = 0;
+        forward_output_copy(task, pipe_fd, length, 0);
+        return;
     }
 
-    pthread_mutex_unlock(&scheduler_mutex);
+    client_send_lock(task->client_fd);
 
-    return selected_task;
+    if (announced && send_output_header(task->client_fd, task->task_id, length) < 0)
+    {
+        client_send_unlock(task->client_fd);
+        forward_output_copy(task, pipe_fd, length, 0);
+        return;
+    }
+
+    while (done < length)
+    {
+        ssize_t moved = splice_to_client(pipe_fd, task->client_fd, length - done);
+
+        if (moved <= 0)
+        {
+            if (moved < 0 && splice_unsupported_errno(errno))
+            {
+                g_splice_unsupported = 1;
+            }
+
+            //finishing the chunk (and an announced frame) by copy
+            forward_output_copy(task, pipe_fd, length - done, announced);
+            break;
+        }
+
+        done += (size_t)moved;
+        task->bytes_sent += (int)moved;
+    }
+
+    client_send_unlock(task->client_fd);
 }
 
-int scheduler_execute_task(Task *task)
+/* ---------- child processes ---------- */
+//starting a task's child in its own process group, so a whole pipeline can
+//be stopped and continued as one: shell commands run under /bin/sh, demo
+//tasks run the demo program; the output pipe stays with the task
+//returns 0 on success, -1 when the child could not be started
+static int child_spawn(Task *task)
 {
-    if (task == NULL)
+    int pipefd[2];
+    char seconds[16];
+    pid_t pid;
+
+    snprintf(seconds, sizeof(seconds), "%d", task->burst_time);
+
+    if (pipe2(pipefd, O_CLOEXEC) == -1)
     {
-        return 0;
+        perror("pipe");
+        return -1;
+    }
+
+    pid = fork();
+
+    if (pid < 0)
+    {
+        perror("fork");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
     }
 
-    if (task->type == TASK_SHELL)
+    if (pid == 0)
     {
-        int pipefd[2];
-        pid_t pid;
+        child_manager_child_setup();
+        setpgid(0, 0);
 
-        if (pipe(pipefd) == -1)
+        if (dup2(pipefd[1], STDOUT_FILENO) == -1)
         {
-            perror("pipe");
-            return 0;
+            perror("dup2 stdout");
+            _exit(1);
+        }
+
+        if (dup2(pipefd[1], STDERR_FILENO) == -1)
+        {
+            perror("dup2 stderr");
+            _exit(1);
         }
 
-        pid = fork();
+        //the server ignores SIGPIPE (splice cannot suppress it); restore
+        //the default so pipelines like `yes | head` still terminate
+        signal(SIGPIPE, SIG_DFL);
 
-        if (pid < 0)
+        if (task->type == TASK_DEMO_PROGRAM)
         {
-            perror("fork");
-            close(pipefd[0]);
-            close(pipefd[1]);
-            return 0;
+            execl(g_demo_path, DEMO_PROGRAM, seconds, (char *)NULL);
+        }
+        else
+        {
+            execlp("/bin/sh", "sh", "-c", task->command, (char *)NULL);
         }
 
-        if (pid == 0)
+        perror("exec");
+        _exit(127);
+    }
+
+    //also set from this side: a stop must not miss a child that has not
+    //reached its own setpgid yet
+    setpgid(pid, pid);
+    close(pipefd[1]);
+
+    //its exit is then seen even while a grandchild keeps the pipe open
+    child_watch(pid);
+
+    task->pid = pid;
+    task->output_fd = pipefd[0];
+
+    return 0;
+}
+
+static uint64_t timeval_us(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000 + (uint64_t)tv->tv_usec;
+}
+
+//collecting the child's exit status and resource usage once it exited
+//and its output reached eof
+static void child_reap(SchedulerWorker *state, Task *task)
+{
+    int status = 0;
+    struct rusage usage;
+
+    close(task->output_fd);
+    task->output_fd = -1;
+
+    memset(&usage, 0, sizeof(usage));
+
+    //at once when its exit was already seen
+    child_collect(task->pid, 1, &status, &usage);
+    child_release(task->pid);
+
+    state->exit_usage.user_us = timeval_us(&usage.ru_utime);
+    state->exit_usage.system_us = timeval_us(&usage.ru_stime);
+    state->exit_usage.max_rss_kb = usage.ru_maxrss;
+    state->exit_usage.voluntary_switches = usage.ru_nvcsw;
+    state->exit_usage.involuntary_switches = usage.ru_nivcsw;
+    state->exit_usage.blocks_in = usage.ru_inblock;
+    state->exit_usage.blocks_out = usage.ru_oublock;
+
+    task->pid = 0;
+
+    if (WIFEXITED(status))
+    {
+        task->exit_status = WEXITSTATUS(status);
+    }
+    else if (WIFSIGNALED(status))
+    {
+        task->exit_status = 128 + WTERMSIG(status);
+    }
+}
+
+/* ---------- quantum and slice timers ---------- */
+void scheduler_begin_quantum(int worker, Task *task, int quantum_ms)
+{
+    SchedulerWorker *state = &g_scheduler.workers[worker];
+    uint64_t start_ms;
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    //slice and quantum boundaries are absolute so a whole-slice quantum
+    //always ends exactly on a slice boundary, however late the worker wakes
+    //up; any other quantum runs from now
+    state->run_start_ns = timer_now_ns();
+    start_ms = state->run_start_ns / 1000000u;
+    state->run_origin_ms = start_ms - (uint64_t)task->slice_elapsed_ms;
+    state->slices_done = 0;
+
+    timer_wheel_add(&state->wheel, &state->quantum_timer,
+                    (quantum_ms % SLICE_MS == 0 ? state->run_origin_ms : start_ms) +
+                    (uint64_t)quantum_ms);
+
+    //deadlines are kept in 32 bits: the distance to it is wrap-safe, a
+    //deadline already behind fires on the first pass
+    if (task->deadline_ms != 0)
+    {
+        int left_ms = (int)(task->deadline_ms - (unsigned int)start_ms);
+
+        timer_wheel_add(&state->wheel, &state->deadline_timer,
+                        start_ms + (uint64_t)(left_ms > 0 ? left_ms : 0));
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+//one pass over what can interrupt the running task: new submissions (one
+//that beats it preempts it right away) and the worker's due timers
+//returns the SLICE_* events raised; the worker's timerfd is armed for the
+//next timer, *timeout gets the ms to it when the timerfd does not cover it
+//(-1: nothing to wait for but the fds)
+static int scheduler_collect_events(int worker, Task *task, int64_t *timeout)
+{
+    SchedulerWorker *state = &g_scheduler.workers[worker];
+    int preempt = queue_drain_intake(worker, task);
+    int events = 0;
+    uint64_t now;
+    TimerEntry *expired;
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    if (preempt)
+    {
+        state->preempt_flag = 1;
+    }
+
+    now = timer_now_ms();
+    expired = timer_wheel_advance(&state->wheel, now);
+
+    for (; expired != NULL; expired = expired->next)
+    {
+        if (expired->kind == TIMER_SLICE)
+        {
+            state->slices_done++;
+            task->slice_elapsed_ms = 0;
+            events |= SLICE_EXPIRED;
+        }
+        else if (expired->kind == TIMER_QUANTUM)
+        {
+            events |= SLICE_QUANTUM;
+        }
+        else if (expired->kind == TIMER_DEADLINE)
         {
-            close(pipefd[0]);
+            events |= SLICE_DEADLINE;
+        }
+    }
+
+    if (state->preempt_flag)
+    {
+        events |= SLICE_PREEMPTED;
+    }
+
+    if (state->cancel_flag)
+    {
+        events |= SLICE_CANCELLED;
+    }
 
-            if (dup2(pipefd[1], STDOUT_FILENO) == -1)
+    *timeout = timer_wheel_next_timeout(&state->wheel, now);
+
+    //a later expiry is left to the timerfd (absolute, so a late pass never
+    //pushes it back); *timeout stays set only when that cannot be armed
+    if (*timeout > 0)
+    {
+        uint64_t expiry_ms = now + (uint64_t)*timeout;
+
+        if (state->timer_fd_expiry_ms != expiry_ms)
+        {
+            struct itimerspec spec;
+
+            memset(&spec, 0, sizeof(spec));
+            spec.it_value.tv_sec = (time_t)(expiry_ms / 1000u);
+            spec.it_value.tv_nsec = (long)(expiry_ms % 1000u) * 1000000L;
+
+            if (timerfd_settime(state->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0)
             {
-                perror("dup2 stdout");
-                _exit(1);
+                state->timer_fd_expiry_ms = expiry_ms;
             }
+        }
+
+        if (state->timer_fd_expiry_ms == expiry_ms)
+        {
+            *timeout = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    return events;
+}
+
+//ending a task that reached its deadline: its whole process group is
+//killed, even while stopped (output still in the pipe is dropped)
+static void child_time_out(SchedulerWorker *state, Task *task)
+{
+    static const char message[] = "Timed out.\n";
+
+    if (task->pid > 0)
+    {
+        kill(-task->pid, SIGKILL);
+        child_reap(state, task);
+    }
+    else
+    {
+        memset(&state->exit_usage, 0, sizeof(state->exit_usage));
+    }
+
+    task->exit_status = TASK_TIMEOUT_STATUS;
+
+    if (send_client_output(task->client_fd, task->proto, task->task_id,
+                           message, sizeof(message) - 1) == 0)
+    {
+        task->bytes_sent += (int)(sizeof(message) - 1);
+    }
+
+    scheduler_log_decision("timed out", task);
+}
+
+//telling a client its task was cancelled
+static void send_cancel_notice(Task *task)
+{
+    static const char message[] = "Cancelled.\n";
+
+    if (send_client_output(task->client_fd, task->proto, task->task_id,
+                           message, sizeof(message) - 1) == 0)
+    {
+        task->bytes_sent += (int)(sizeof(message) - 1);
+    }
+}
+
+//ending a running task that was cancelled: its whole process group is
+//killed like at a deadline, and the client told unless it is gone
+static void child_cancel(SchedulerWorker *state, Task *task, int reason)
+{
+    if (task->pid > 0)
+    {
+        kill(-task->pid, SIGKILL);
+        child_reap(state, task);
+    }
+    else
+    {
+        memset(&state->exit_usage, 0, sizeof(state->exit_usage));
+    }
+
+    task->exit_status = TASK_CANCELLED_STATUS;
+
+    if (reason != CANCEL_CLIENT_GONE)
+    {
+        send_cancel_notice(task);
+    }
+
+    scheduler_log_decision("cancelled", task);
+}
+
+int scheduler_run_child(int worker, Task *task)
+{
+    SchedulerWorker *state = &g_scheduler.workers[worker];
+    int wake_fd = state->wake_fd;
+
+    //the task ends once its child exited and its output pipe hung up (a
+    //grandchild may hold it open longer, a child may close it early)
+    int exited = 0;
+    int hung_up = 0;
+    int child_fd = -1;
+
+    //a task whose deadline passed while it waited is never started
+    if (task->pid == 0 && task->deadline_ms != 0 &&
+        (int)(task->deadline_ms - (unsigned int)timer_now_ms()) <= 0)
+    {
+        child_time_out(state, task);
+        return SLICE_EXITED | SLICE_DEADLINE;
+    }
+
+    if (task->pid == 0)
+    {
+        if (child_spawn(task) < 0)
+        {
+            memset(&state->exit_usage, 0, sizeof(state->exit_usage));
+            task->exit_status = 1;
+            return SLICE_EXITED;
+        }
+    }
+    else
+    {
+        //harmless when the group is already running (between two slices)
+        kill(-task->pid, SIGCONT);
+        exited = child_collect(task->pid, 0, NULL, NULL) == 1;
+    }
+
+    child_fd = child_watch_fd(task->pid);
+
+    if (task->type == TASK_DEMO_PROGRAM && task->remaining_time > 0)
+    {
+        pthread_mutex_lock(&scheduler_mutex);
+
+        if (!state->slice_timer.pending)
+        {
+            timer_wheel_add(&state->wheel, &state->slice_timer,
+                            state->run_origin_ms + (uint64_t)(state->slices_done + 1) * SLICE_MS);
+        }
+
+        pthread_mutex_unlock(&scheduler_mutex);
+    }
+
+    while (1)
+    {
+        struct pollfd pfds[4];
+        int64_t timeout;
+        int events = scheduler_collect_events(worker, task, &timeout);
+
+        if (events & SLICE_CANCELLED)
+        {
+            child_cancel(state, task, scheduler_check_cancel(worker));
+            return SLICE_EXITED | SLICE_CANCELLED;
+        }
+
+        if (events & SLICE_DEADLINE)
+        {
+            child_time_out(state, task);
+            return SLICE_EXITED | SLICE_DEADLINE;
+        }
+
+        if (events & (SLICE_QUANTUM | SLICE_PREEMPTED))
+        {
+            //output already in the pipe waits there until the task resumes
+            kill(-task->pid, SIGSTOP);
+            return events;
+        }
+
+        //a finished demo slice is accounted by the caller before going on
+        if (events & SLICE_EXPIRED)
+        {
+            return events;
+        }
+
+        pfds[0].fd = hung_up ? -1 : task->output_fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = wake_fd;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        pfds[2].fd = state->timer_fd;
+        pfds[2].events = POLLIN;
+        pfds[2].revents = 0;
+        pfds[3].fd = exited ? -1 : child_fd;
+        pfds[3].events = POLLIN;
+        pfds[3].revents = 0;
+
+        if (poll(pfds, 4, timeout < 0 || timeout > INT_MAX ? -1 : (int)timeout) < 0)
+        {
+            continue;
+        }
+
+        if (pfds[2].revents & POLLIN)
+        {
+            uint64_t expirations;
 
-            if (dup2(pipefd[1], STDERR_FILENO) == -1)
+            //the expired timers are collected by the next pass, which arms
+            //the timerfd again for the one after
+            if (read(state->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
             {
-                perror("dup2 stderr");
-                _exit(1);
+                perror("timerfd read");
             }
 
-            close(pipefd[1]);
+            state->timer_fd_expiry_ms = 0;
+        }
 
-            execlp("/bin/sh", "sh", "-c", task->command, NULL);
+        if (pfds[1].revents & POLLIN)
+        {
+            uint64_t count;
 
-            perror("execlp");
-            _exit(127);
+            //the wakeup itself is handled by the next collect pass
+            if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+            {
+                perror("eventfd read");
+            }
         }
-        else
-        {
-            char buffer[BUFFER_SIZE];
-            ssize_t n;
 
-            close(pipefd[1]);
+        if (pfds[0].revents != 0)
+        {
+            int available = 0;
 
-            while ((n = read(pipefd[0], buffer, sizeof(buffer))) > 0)
+            if (ioctl(task->output_fd, FIONREAD, &available) == 0 && available > 0)
             {
-                if (send_all(task->client_fd, buffer, (size_t)n) == 0)
+                forward_output_chunk(task, task->output_fd, (size_t)available);
+            }
+            else if (pfds[0].revents & (POLLHUP | POLLERR))
+            {
+                hung_up = 1;
+
+                //an unwatched child is waited for here, as it always was
+                if (child_fd < 0)
                 {
-                    task->bytes_sent += (int)n;
+                    exited = 1;
                 }
             }
+        }
 
-            close(pipefd[0]);
-            waitpid(pid, NULL, 0);
+        if (pfds[3].revents != 0)
+        {
+            exited = child_collect(task->pid, 0, NULL, NULL) == 1;
+        }
 
-            return 1;
+        if (exited && hung_up)
+        {
+            child_reap(state, task);
+            return SLICE_EXITED;
         }
     }
+}
 
-    if (task->type == TASK_DEMO_PROGRAM)
+void scheduler_grant_grace(int worker)
 {
-    int current_iteration = task->burst_time - task->remaining_time;
+    SchedulerWorker *state = &g_scheduler.workers[worker];
 
-    int sent = dprintf(task->client_fd,
-                       "Demo %d/%d\n",
-                       current_iteration,
-                       task->burst_time);
+    pthread_mutex_lock(&scheduler_mutex);
 
-    if (sent > 0)
-    {
-        task->bytes_sent += sent;
-    }
+    timer_wheel_add(&state->wheel, &state->quantum_timer, timer_now_ms() + SLICE_MS);
+    state->preempt_flag = 0;
+    state->preempting_task_id = -1;
 
-    if (task->remaining_time > 0)
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+uint64_t scheduler_end_quantum(int worker, Task *task)
+{
+    SchedulerWorker *state = &g_scheduler.workers[worker];
+    uint64_t now_ns = timer_now_ns();
+    uint64_t now = now_ns / 1000000u;
+    uint64_t served_ns;
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    //an interrupted slice keeps the part already served; the rest is run
+    //when the task is scheduled again
+    if (state->slice_timer.pending)
     {
-        sleep(1);
+        uint64_t served = now - state->run_origin_ms;
+
+        served -= (uint64_t)state->slices_done * SLICE_MS;
+        task->slice_elapsed_ms = served < SLICE_MS ? (int)served : SLICE_MS - 1;
+
+        timer_wheel_cancel(&state->wheel, &state->slice_timer);
     }
 
-    if (task->remaining_time == 0)
+    timer_wheel_cancel(&state->wheel, &state->quantum_timer);
+    timer_wheel_cancel(&state->wheel, &state->deadline_timer);
+
+    served_ns = now_ns - state->run_start_ns;
+
+    if (task->type == TASK_DEMO_PROGRAM)
     {
-        return 1;
+        g_scheduler.total_service_ns += served_ns;
     }
 
-    return 0;
-}
+    pthread_mutex_unlock(&scheduler_mutex);
 
-    return 0;
+    return served_ns;
 }
 
 void scheduler_update_task_after_execution(Task *task, int time_used)
@@ -322,12 +954,65 @@ void scheduler_log_decision(const char *event_type, Task *task)
     }
     else if (strcmp(event_type, "ended") == 0)
     {
-        log_printf_locked("(%d)--- ended (%d)\n", task->client_id, task->remaining_time);
+        //what its child consumed (the ending worker's latest reap)
+        const TaskUsage *usage = &g_scheduler.workers[task->worker].exit_usage;
+
+        log_printf_locked(
+            "(%d)--- ended (%d) | cpu user=%.3fs sys=%.3fs | maxrss=%ld KB | csw vol=%ld invol=%ld | blocks in=%ld out=%ld\n",
+            task->client_id,
+            task->remaining_time,
+            usage->user_us / 1e6,
+            usage->system_us / 1e6,
+            usage->max_rss_kb,
+            usage->voluntary_switches,
+            usage->involuntary_switches,
+            usage->blocks_in,
+            usage->blocks_out);
     }
     else if (strcmp(event_type, "preempted") == 0)
     {
         log_printf_locked("(%d)--- preempted (%d)\n", task->client_id, task->remaining_time);
     }
+    else if (strcmp(event_type, "timed out") == 0)
+    {
+        log_printf_locked("(%d)--- timed out (%d)\n", task->client_id, task->remaining_time);
+    }
+    else if (strcmp(event_type, "cancelled") == 0)
+    {
+        log_printf_locked("(%d)--- cancelled (%d)\n", task->client_id, task->remaining_time);
+    }
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+//logging p50/p99 of the retained response samples of one kind (caller
+//holds scheduler_mutex)
+static void print_response_times(const char *label, const ResponseTimes *times)
+{
+    static uint32_t sorted[RESPONSE_SAMPLES];
+    size_t n = times->count < RESPONSE_SAMPLES ? (size_t)times->count : RESPONSE_SAMPLES;
+
+    if (n == 0)
+    {
+        log_printf_locked("%s Response: none\n", label);
+        return;
+    }
+
+    memcpy(sorted, times->ms, n * sizeof(sorted[0]));
+    qsort(sorted, n, sizeof(sorted[0]), compare_ms);
+
+    log_printf_locked(
+        "%s Response: %llu tasks, p50 %u ms, p99 %u ms\n",
+        label,
+        (unsigned long long)times->count,
+        sorted[(n - 1) / 2],
+        sorted[(n * 99 + 99) / 100 - 1]);
 }
 
 void scheduler_print_summary(void)
@@ -338,10 +1023,26 @@ void scheduler_print_summary(void)
         "=== Scheduler Summary ===\n"
         "Total Completed: %d\n"
         "Total Time Used: %d\n"
-        "Final Round: %d\n",
+        "Demo Service: %.3f ms\n"
+        "Final Round: %d\n"
+        "Child CPU: user %.3fs, sys %.3fs\n"
+        "Child Max RSS: %ld KB\n"
+        "Child Context Switches: %ld voluntary, %ld involuntary\n"
+        "Child Block I/O: %ld in, %ld out\n",
         g_scheduler.total_completed,
         g_scheduler.total_time_used,
-        g_scheduler.round_number);
+        g_scheduler.total_service_ns / 1e6,
+        g_scheduler.round_number,
+        g_scheduler.total_usage.user_us / 1e6,
+        g_scheduler.total_usage.system_us / 1e6,
+        g_scheduler.total_usage.max_rss_kb,
+        g_scheduler.total_usage.voluntary_switches,
+        g_scheduler.total_usage.involuntary_switches,
+        g_scheduler.total_usage.blocks_in,
+        g_scheduler.total_usage.blocks_out);
+
+    print_response_times("Interactive", &g_scheduler.interactive_response);
+    print_response_times("Batch", &g_scheduler.batch_response);
 
     pthread_mutex_unlock(&scheduler_mutex);
 }
@@ -351,32 +1052,91 @@ SchedulerState *scheduler_get_state(void)
     return &g_scheduler;
 }
 
+SchedulerWorker *scheduler_get_worker(int worker)
+{
+    return &g_scheduler.workers[worker];
+}
+
+void scheduler_record_completion(int worker, const Task *task)
+{
+    const TaskUsage *usage = &g_scheduler.workers[worker].exit_usage;
+    TaskUsage *total = &g_scheduler.total_usage;
+    ResponseTimes *times = task->boost_ms > 0 ? &g_scheduler.interactive_response
+                                              : &g_scheduler.batch_response;
+    uint32_t response_ms = (unsigned int)timer_now_ms() - task->submitted_ms;
+
+    pthread_mutex_lock(&scheduler_mutex);
+    g_scheduler.total_completed++;
+
+    times->ms[times->count % RESPONSE_SAMPLES] = response_ms;
+    times->count++;
+
+    total->user_us += usage->user_us;
+    total->system_us += usage->system_us;
+    total->voluntary_switches += usage->voluntary_switches;
+    total->involuntary_switches += usage->involuntary_switches;
+    total->blocks_in += usage->blocks_in;
+    total->blocks_out += usage->blocks_out;
+
+    if (usage->max_rss_kb > total->max_rss_kb)
+    {
+        total->max_rss_kb = usage->max_rss_kb;
+    }
+
+    g_scheduler.workers[worker].last_selected_task_id = -1;
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+int scheduler_claim_summary(void)
+{
+    int claimed = 0;
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    if (g_scheduler.total_completed > g_scheduler.total_summarised)
+    {
+        g_scheduler.total_summarised = g_scheduler.total_completed;
+        claimed = 1;
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    return claimed;
+}
+
 int scheduler_should_preempt(Task *new_task, Task *current_task)
 {
-    if (current_task == NULL)
+    if (current_task == NULL || new_task == NULL)
     {
         return 0;
     }
 
-    if (current_task->type == TASK_SHELL)
+    //a command typed in an active session goes ahead of batch work and
+    //is not interrupted by it while its boost lasts
+    int new_boost = sched_policy_boost_left(new_task);
+    int current_boost = sched_policy_boost_left(current_task);
+
+    if ((new_boost > 0) != (current_boost > 0))
     {
-        return 0;
+        return new_boost > 0;
     }
 
-    if (new_task != NULL && new_task->type == TASK_SHELL)
+    //a shell command keeps its first quantum against demos, so short
+    //commands finish without ever being stopped
+    if (current_task->type == TASK_SHELL && current_task->round_count == 0 &&
+        new_task->type != TASK_SHELL)
     {
-        return 1;
+        return 0;
     }
 
-    if (new_task != NULL && current_task != NULL)
+    if (new_task->type == TASK_SHELL && current_task->type != TASK_SHELL)
     {
-        if (new_task->remaining_time < current_task->remaining_time)
-        {
-            return 1;
-        }
+        return 1;
     }
 
-    return 0;
+    //anything else (demo against demo, shell against shell, a demo against
+    //a long-running shell) is up to the active policy
+    return queue_policy()->should_preempt(new_task, current_task);
 }
 
 void scheduler_preempt_task(Task *task)
@@ -395,23 +1155,65 @@ void scheduler_resume_task(Task *task)
     }
 }
 
-void scheduler_notify_new_task(Task *new_task)
+void scheduler_notify_new_task(int worker)
 {
-    pthread_mutex_lock(&scheduler_mutex);
+    //lock-free: the preemption decision is made by the woken worker when it
+    //drains its intake (queue_drain_intake), not by the submitting thread
+    scheduler_wake_owner(worker);
+}
+
+void scheduler_wake_owner(int worker)
+{
+    int peer;
+
+    scheduler_wake(worker);
+
+    peer = queue_find_idle_worker(worker);
+
+    if (peer >= 0)
+    {
+        scheduler_wake(peer);
+    }
+}
+
+void scheduler_wake(int worker)
+{
+    uint64_t one = 1;
 
-    if (g_scheduler.current_task != NULL && new_task != NULL)
+    //a full counter (EAGAIN) already means "wake up"
+    if (write(g_scheduler.workers[worker].wake_fd, &one, sizeof(one)) < 0 &&
+        errno != EAGAIN)
     {
-        if (scheduler_should_preempt(new_task, g_scheduler.current_task))
+        perror("eventfd write");
+    }
+}
+
+void scheduler_wait(int worker, int timeout_ms)
+{
+    struct pollfd pfd;
+    uint64_t count;
+
+    pfd.fd = g_scheduler.workers[worker].wake_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, timeout_ms) > 0)
+    {
+        //draining the counter; the caller re-checks its queues afterwards,
+        //so wakeups posted before this point are never lost
+        if (read(pfd.fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
         {
-            g_preempt_flag = 1;
-            g_preempting_task_id = new_task->task_id;
+            perror("eventfd read");
         }
     }
+}
 
-    pthread_mutex_unlock(&scheduler_mutex);
+int scheduler_wake_fd(int worker)
+{
+    return g_scheduler.workers[worker].wake_fd;
 }
 
-void scheduler_append_trace(int task_id, int seconds_run)
+void scheduler_append_trace(int task_id, int time_run)
 {
     pthread_mutex_lock(&scheduler_mutex);
 
@@ -426,7 +1228,7 @@ void scheduler_append_trace(int task_id, int seconds_run)
                          sizeof(g_trace) - g_trace_len,
                          "P%d-(%d)",
                          task_id,
-                         seconds_run);
+                         time_run);
 
         if (n > 0)
         {
@@ -444,42 +1246,236 @@ const char *scheduler_get_trace(void)
     return g_trace;
 }
 
-void scheduler_set_current_task(Task *task)
+void scheduler_set_current_task(int worker, Task *task)
 {
     pthread_mutex_lock(&scheduler_mutex);
-    g_scheduler.current_task = task;
+    g_scheduler.workers[worker].current_task = task;
+    g_scheduler.workers[worker].cancel_flag = 0;
     pthread_mutex_unlock(&scheduler_mutex);
+
+    t_send_worker = worker;
+    t_send_task = task;
 }
 
-void scheduler_clear_current_task(void)
+static int client_running(int client_id);
+
+void scheduler_clear_current_task(int worker)
 {
+    Task *task;
+    ClosingClient *closing = NULL;
+
     pthread_mutex_lock(&scheduler_mutex);
-    g_scheduler.current_task = NULL;
+
+    task = g_scheduler.workers[worker].current_task;
+    g_scheduler.workers[worker].current_task = NULL;
+    t_send_worker = -1;
+    t_send_task = NULL;
+
+    //the last running task of a disconnected client releases it
+    if (task != NULL && g_closing != NULL && !client_running(task->client_id))
+    {
+        for (ClosingClient **link = &g_closing; *link != NULL; link = &(*link)->next)
+        {
+            if ((*link)->client_id == task->client_id)
+            {
+                closing = *link;
+                *link = closing->next;
+                break;
+            }
+        }
+    }
+
     pthread_mutex_unlock(&scheduler_mutex);
+
+    if (closing != NULL)
+    {
+        closing->release(closing->client_id, closing->client_fd);
+        free(closing);
+    }
 }
 
-int scheduler_check_preempt(void)
+int scheduler_check_preempt(int worker)
 {
     int value;
 
     pthread_mutex_lock(&scheduler_mutex);
-    value = g_preempt_flag;
+    value = g_scheduler.workers[worker].preempt_flag;
     pthread_mutex_unlock(&scheduler_mutex);
 
     return value;
 }
 
-void scheduler_clear_preempt(void)
+void scheduler_clear_preempt(int worker)
 {
     pthread_mutex_lock(&scheduler_mutex);
-    g_preempt_flag = 0;
-    g_preempting_task_id = -1;
+    g_scheduler.workers[worker].preempt_flag = 0;
+    g_scheduler.workers[worker].preempting_task_id = -1;
     pthread_mutex_unlock(&scheduler_mutex);
 }
 
-void scheduler_add_quantum_consumed(int inc)
+void scheduler_add_quantum_consumed(int worker, int inc)
 {
     pthread_mutex_lock(&scheduler_mutex);
-    g_scheduler.quantum_consumed += inc;
+    g_scheduler.workers[worker].quantum_consumed += inc;
     pthread_mutex_unlock(&scheduler_mutex);
 }
+
+void scheduler_lock_dispatch(int worker)
+{
+    pthread_mutex_lock(&g_scheduler.workers[worker].dispatch_mutex);
+}
+
+void scheduler_unlock_dispatch(int worker)
+{
+    pthread_mutex_unlock(&g_scheduler.workers[worker].dispatch_mutex);
+}
+
+int scheduler_check_cancel(int worker)
+{
+    int value;
+
+    pthread_mutex_lock(&scheduler_mutex);
+    value = g_scheduler.workers[worker].cancel_flag;
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    return value;
+}
+
+/* ---------- cancellation ---------- */
+//a task a cancellation is after (see queue_take_client_tasks)
+static int cancel_matches(const Task *task, int client_id, int task_id)
+{
+    return task != NULL && task->client_id == client_id &&
+           (task_id <= 0 || task->task_id == task_id);
+}
+
+//returns 1 while some worker runs a task of the client (caller holds
+//scheduler_mutex)
+static int client_running(int client_id)
+{
+    for (int i = 0; i < g_scheduler.worker_count; i++)
+    {
+        if (cancel_matches(g_scheduler.workers[i].current_task, client_id, 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int scheduler_cancel_tasks(int client_id, int task_id, int reason)
+{
+    int workers = g_scheduler.worker_count;
+    int flagged[MAX_WORKERS];
+    int count = 0;
+    Task *taken;
+
+    //with every dispatch_mutex held no task is between a run queue and a
+    //worker: each one is either taken below or some worker's current task
+    for (int i = 0; i < workers; i++)
+    {
+        scheduler_lock_dispatch(i);
+    }
+
+    taken = queue_take_client_tasks(client_id, task_id);
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    for (int i = 0; i < workers; i++)
+    {
+        SchedulerWorker *state = &g_scheduler.workers[i];
+
+        flagged[i] = cancel_matches(state->current_task, client_id, task_id);
+
+        //a disconnect overrides an earlier request (nothing is sent any more)
+        if (flagged[i] && state->cancel_flag < reason)
+        {
+            state->cancel_flag = reason;
+        }
+
+        count += flagged[i];
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    for (int i = workers - 1; i >= 0; i--)
+    {
+        scheduler_unlock_dispatch(i);
+    }
+
+    for (int i = 0; i < workers; i++)
+    {
+        if (flagged[i])
+        {
+            scheduler_wake(i);
+        }
+    }
+
+    while (taken != NULL)
+    {
+        Task *next = taken->next;
+
+        scheduler_end_cancelled(taken, reason);
+        count++;
+        taken = next;
+    }
+
+    return count;
+}
+
+void scheduler_release_client(int client_id, int client_fd, ClientRelease release)
+{
+    ClosingClient *closing = (ClosingClient *)malloc(sizeof(ClosingClient));
+    int running;
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    running = client_running(client_id);
+
+    if (running && closing != NULL)
+    {
+        closing->client_id = client_id;
+        closing->client_fd = client_fd;
+        closing->release = release;
+        closing->next = g_closing;
+        g_closing = closing;
+    }
+
+    //out of memory: the running tasks were shut out of the socket by the
+    //caller's shutdown and are flagged, so waiting for them is the fallback
+    while (running && closing == NULL && client_running(client_id))
+    {
+        pthread_mutex_unlock(&scheduler_mutex);
+        poll(NULL, 0, 1);
+        pthread_mutex_lock(&scheduler_mutex);
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    if (!running || closing == NULL)
+    {
+        free(closing);
+        release(client_id, client_fd);
+    }
+}
+
+void scheduler_end_cancelled(Task *task, int reason)
+{
+    task->exit_status = TASK_CANCELLED_STATUS;
+
+    if (reason != CANCEL_CLIENT_GONE)
+    {
+        send_cancel_notice(task);
+    }
+
+    //a DAG node reports to its DAG instead (even when the client is gone,
+    //so the DAG is freed)
+    if (!dag_task_end(task) && reason != CANCEL_CLIENT_GONE)
+    {
+        send_client_end(task->client_fd, task->proto, task->task_id, TASK_CANCELLED_STATUS);
+    }
+
+    scheduler_log_decision("cancelled", task);
+    free_task(task);
+}
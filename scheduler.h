@@ -2,43 +2,188 @@
 #define SCHEDULER_H
 
 #include "scheduler_queue.h"
+#include "timer_wheel.h"
 
-//holding core scheduler state including current running task and quantum tracking
+#include <pthread.h>
+
+
+//length of one demo slice (one "Demo i/N" line of the demo program)
+#define SLICE_MS 1000
+
+//timer kinds armed on a worker's wheel
+#define TIMER_SLICE 1
+#define TIMER_QUANTUM 2
+#define TIMER_DEADLINE 3
+
+//exit status of a task killed at its deadline (as timeout(1) reports it)
+#define TASK_TIMEOUT_STATUS 124
+
+//exit status of a cancelled task (as a shell reports a command stopped
+//with Ctrl-C)
+#define TASK_CANCELLED_STATUS 130
+
+//why a task is cancelled: its client asked (it gets a notice and the end
+//of the response), or its client disconnected (nothing is sent any more)
+#define CANCEL_REQUESTED 1
+#define CANCEL_CLIENT_GONE 2
+
+//events reported by scheduler_run_child (may be combined)
+#define SLICE_EXPIRED 0x1      //the running slice was fully served
+#define SLICE_QUANTUM 0x2      //the quantum ran out
+#define SLICE_PREEMPTED 0x4    //a better task arrived on this worker's queue
+#define SLICE_EXITED 0x8       //the task's child process finished
+#define SLICE_DEADLINE 0x10    //it was killed at its deadline (with SLICE_EXITED)
+#define SLICE_CANCELLED 0x20   //it was cancelled and killed (with SLICE_EXITED)
+
+//resources a task's child process used over its whole life (wait4 rusage)
+typedef struct
+{
+    uint64_t user_us;                //user CPU time
+    uint64_t system_us;              //system CPU time
+    long max_rss_kb;                 //peak resident set size
+    long voluntary_switches;         //blocked waiting for something
+    long involuntary_switches;       //preempted by the kernel
+    long blocks_in;                  //file system block reads
+    long blocks_out;                 //file system block writes
+} TaskUsage;
+
+//response times (submission to the end of the reply) of the latest
+//completed tasks of one kind, for percentiles in the summary
+#define RESPONSE_SAMPLES 4096
+
+typedef struct
+{
+    uint32_t ms[RESPONSE_SAMPLES];   //ring of the latest samples
+    uint64_t count;                  //samples ever recorded
+} ResponseTimes;
+
+//holding per-worker execution state; each executor worker runs one task at
+//a time from its own run queue
 typedef struct
 {
     //currently executing task or null if idle
     Task *current_task;
 
-    //consumed quantum time in current round (0 to quantum_size)
+    //consumed quantum time in current round
     int quantum_consumed;
 
-    //current round number starting from 1
-    int round_number;
-
-    //quantum size for current round (3 for round 1, 7 for later rounds)
-    int quantum_size;
-
     //task id of last selected task to prevent consecutive selection
     int last_selected_task_id;
 
+    //set when a better task arrived on this worker's queue
+    int preempt_flag;
+    int preempting_task_id;
+
+    //set (CANCEL_*) when the running task was cancelled
+    int cancel_flag;
+
+    //held while a task moves between the run queues and this worker (taken
+    //and made current, or requeued), so a cancellation finds every task in
+    //one place or the other
+    pthread_mutex_t dispatch_mutex;
+
+    //slice/quantum expiry of the running task; the worker sleeps on
+    //wake_fd until the earliest timer or until new work/preemption signals it
+    TimerWheel wheel;
+    TimerEntry slice_timer;
+    TimerEntry quantum_timer;
+    TimerEntry deadline_timer;
+
+    //eventfd written by scheduler_wake (pollable, e.g. from an epoll loop)
+    int wake_fd;
+
+    //timerfd armed (absolute, CLOCK_MONOTONIC) at the wheel's earliest
+    //expiry while a task runs, and that expiry in ms (0: not armed)
+    int timer_fd;
+    uint64_t timer_fd_expiry_ms;
+
+    //start of the current quantum, shifted back by the slice part the task
+    //had already served, and the full slices completed since then
+    uint64_t run_origin_ms;
+    int slices_done;
+
+    //when the current quantum actually started (service accounting, ns)
+    uint64_t run_start_ns;
+
+    //usage of the child reaped last by this worker (valid once
+    //scheduler_run_child returned SLICE_EXITED, until the next task runs)
+    TaskUsage exit_usage;
+
+} SchedulerWorker;
+
+//holding core scheduler state shared by all executor workers
+typedef struct
+{
+    //number of executor workers (server -w)
+    int worker_count;
+
+    //per-worker state, indexed by worker number
+    SchedulerWorker workers[MAX_WORKERS];
+
+    //current round number starting from 1
+    int round_number;
+
     //total tasks completed
     int total_completed;
 
+    //completions already covered by a printed trace summary
+    int total_summarised;
+
     //total time spent (summing all execution slices)
     int total_time_used;
 
+    //service demo tasks received (ns on CLOCK_MONOTONIC, partial slices
+    //included)
+    uint64_t total_service_ns;
+
+    //child resource usage of every completed task (CPU times and counters
+    //summed, max_rss_kb the largest seen)
+    TaskUsage total_usage;
+
+    //response times of commands typed in an active session and of the rest
+    ResponseTimes interactive_response;
+    ResponseTimes batch_response;
+
 } SchedulerState;
 
-//initializing scheduler state at startup
-void scheduler_init(void);
+//initializing scheduler state at startup for the given pool size
+//returns 0 on success, -1 when the worker wakeup fds cannot be created
+int scheduler_init(int workers);
 
-//selecting next task from queue based on SJRF + RR algorithm
+//selecting next task from a worker's queue by the active policy
+//without removing it (take it with dequeue_task_by_id); O(1), never mutates
+//the queue or raises a preempt flag
 //returns pointer to task or null if queue empty
-Task *scheduler_select_next_task(void);
+Task *scheduler_select_next_task(int worker);
+
+//arming the quantum timer for a task about to run quantum_ms on worker
+//(a whole number of slices ends on a slice boundary, counting the part of
+//a demo slice it already served), and its deadline timer
+void scheduler_begin_quantum(int worker, Task *task, int quantum_ms);
+
+//running a task's child process (the shell command, or the demo program
+//for a demo task): its first run starts it in a process group of its own,
+//later runs SIGCONT that group; its output is forwarded as it arrives until
+//it exits, the quantum runs out or a better task arrives, when the whole
+//group is SIGSTOPped with its pipe intact; a demo task also returns at
+//each slice boundary, still running, so the caller can account the slice
+//a task reaching its deadline is killed with its whole group (or not
+//started at all when it is already late) and ends with TASK_TIMEOUT_STATUS
+//returns SLICE_EXITED (exit_status set, plus SLICE_DEADLINE on a timeout)
+//or the SLICE_EXPIRED / SLICE_QUANTUM / SLICE_PREEMPTED mask; the child is
+//stopped whenever the mask holds SLICE_QUANTUM or SLICE_PREEMPTED
+int scheduler_run_child(int worker, Task *task);
+
+//giving a demo task whose last slice was just accounted one more slice to
+//print its final line and exit (slices are wall-clock time, the program
+//counts its own CPU time, so under contention it may need longer): the
+//quantum timer is re-armed for SLICE_MS and a pending preemption dropped
+void scheduler_grant_grace(int worker);
 
-//executing given task for up to quantum milliseconds
-//returns 1 if task completed, 0 if task should requeue
-int scheduler_execute_task(Task *task);
+//disarming the worker's timers and saving how much of an interrupted slice
+//the task already received
+//returns the nanoseconds of service this quantum gave the task
+uint64_t scheduler_end_quantum(int worker, Task *task);
 
 //updating task state after execution (remaining time, round count)
 void scheduler_update_task_after_execution(Task *task, int time_used);
@@ -46,13 +191,28 @@ void scheduler_update_task_after_execution(Task *task, int time_used);
 //logging scheduler decision (task selection, preemption, etc)
 void scheduler_log_decision(const char *event_type, Task *task);
 
-//printing final summary statistics
+//printing summary statistics: completions, time used, the resources their
+//child processes consumed and interactive/batch response time percentiles
 void scheduler_print_summary(void);
 
 //getting current scheduler state (read-only)
 SchedulerState *scheduler_get_state(void);
 
-//checking if current task should be preempted by new incoming task
+//getting one worker's state
+SchedulerWorker *scheduler_get_worker(int worker);
+
+//counting a finished task, adding the usage of its child (the worker's
+//exit_usage) to the pool totals and sampling its response time
+void scheduler_record_completion(int worker, const Task *task);
+
+//returns 1 exactly once per batch of completions whose trace has not been
+//printed yet (the caller prints it when the pool goes idle)
+int scheduler_claim_summary(void);
+
+//checking if current task should be preempted by new incoming task: a task
+//with interactive boost left preempts batch work and is never preempted by
+//it, a new shell command preempts a running demo, a shell in its first
+//quantum is never preempted by a demo, otherwise the active policy decides
 //returns 1 if preemption should occur, 0 otherwise
 int scheduler_should_preempt(Task *new_task, Task *current_task);
 
@@ -62,25 +222,74 @@ void scheduler_preempt_task(Task *task);
 //marking task as resumed after preemption
 void scheduler_resume_task(Task *task);
 
-//notify scheduler that a new task was enqueued (used to trigger preemption)
-void scheduler_notify_new_task(Task *new_task);
+//notify scheduler that a new task was submitted to worker's intake (wakes
+//the worker, which decides on preemption when it drains the intake)
+void scheduler_notify_new_task(int worker);
+
+//waking worker, plus an idle peer that can steal from it when it is busy
+void scheduler_wake_owner(int worker);
+
+//waking one worker (safe from any thread; wakeups are never lost)
+void scheduler_wake(int worker);
+
+//blocking a worker until it is woken or timeout_ms passes (-1: no timeout)
+void scheduler_wait(int worker, int timeout_ms);
+
+//returns the worker's wakeup eventfd
+int scheduler_wake_fd(int worker);
 
-//append execution trace entry (e.g. "P5-(3)")
-void scheduler_append_trace(int task_id, int seconds_run);
+//append execution trace entry (e.g. "P5-(3)"); time_run is the pool's
+//total in whatever unit the caller traces (seconds or ms)
+void scheduler_append_trace(int task_id, int time_run);
 
 //get trace string (owned by scheduler)
 const char *scheduler_get_trace(void);
 
-//set/clear current task (scheduler-managed)
-void scheduler_set_current_task(Task *task);
-void scheduler_clear_current_task(void);
+//waiting until client_fd takes more data; on a worker running a task the
+//wait also ends when the task is cancelled or reaches its deadline, after
+//the socket is shut down (a frame may be cut short)
+//returns 0 when writable, -1 with errno ECANCELED when the client is given up
+int scheduler_wait_writable(int client_fd);
+
+//set/clear a worker's current task (scheduler-managed)
+void scheduler_set_current_task(int worker, Task *task);
+void scheduler_clear_current_task(int worker);
+
+//check if a worker's preempt flag is set (non-zero) without clearing
+int scheduler_check_preempt(int worker);
+
+//clear a worker's preempt flag
+void scheduler_clear_preempt(int worker);
+
+//taking and releasing a worker's dispatch_mutex
+void scheduler_lock_dispatch(int worker);
+void scheduler_unlock_dispatch(int worker);
+
+//returns the worker's cancel flag (CANCEL_*, 0 when not cancelled)
+int scheduler_check_cancel(int worker);
+
+//cancelling a client's tasks, all of them or with task_id > 0 only that
+//one: queued ones are ended here, running ones are flagged and their worker
+//kills their process group at once (a task is never requeued once flagged);
+//each ends with TASK_CANCELLED_STATUS. It never waits for a running task
+//to stop (see scheduler_release_client)
+//returns how many tasks were cancelled
+int scheduler_cancel_tasks(int client_id, int task_id, int reason);
+
+//what releases a disconnected client once nothing uses its socket
+typedef void (*ClientRelease)(int client_id, int client_fd);
 
-//check if preempt flag is set (non-zero) without clearing
-int scheduler_check_preempt(void);
+//handing a disconnected client (its tasks already cancelled) over for
+//release: release(client_id, client_fd) runs once no worker runs a task of
+//the client any more, right here when none does, otherwise on the worker
+//whose task stops last; the caller does not wait for it
+void scheduler_release_client(int client_id, int client_fd, ClientRelease release);
 
-//clear preempt flag
-void scheduler_clear_preempt(void);
-//increment quantum consumed counter
-void scheduler_add_quantum_consumed(int inc);
+//ending a cancelled task that is off the CPU: notice and end of response
+//(unless reason is CANCEL_CLIENT_GONE), log line, and free_task, which
+//kills a started process group
+void scheduler_end_cancelled(Task *task, int reason);
+//increment a worker's quantum consumed counter
+void scheduler_add_quantum_consumed(int worker, int inc);
 
 #endif
@@ -1,20 +1,106 @@
 #include "scheduler_queue.h"
+#include "sched_policy.h"
+#include "burst_predictor.h"
+#include "child_manager.h"
+#include "dag.h"
+#include "slab.h"
+#include "timer_wheel.h"
 #include <pthread.h>
+#include <signal.h>
 
-extern void scheduler_notify_new_task(Task *new_task);
+extern void scheduler_notify_new_task(int worker);
+extern void scheduler_wake_owner(int worker);
+extern int scheduler_should_preempt(Task *new_task, Task *current_task);
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <unistd.h>
+
+//one run queue per executor worker; each has its own lock so workers only
+//contend when an idle peer steals or a client disconnects: new tasks are
+//pushed lock-free onto the worker's intake stack and moved into the run
+//queue by the worker itself, a whole batch per lock acquisition
+//tasks wait in binary min-heaps ordered by the queue's policy whose slots
+//are mirrored in task->heap_index so any task can be removed in O(log n):
+//one heap of fresh shell commands, which always go first, and one of demo
+//tasks for the whole queue, or one per client under a per-client policy
+//(a shell command that was stopped after a quantum waits among the demos)
+typedef struct
+{
+    pthread_mutex_t mutex;
+    TaskHeap shells;
+    TaskHeap demos;
+    ClientGroup *groups;
+    int length;
+    int busy;
+
+    //the policy its heaps are ordered by (changes only under mutex) and the
+    //sequence stamped on every task entering the queue
+    const SchedPolicyOps *policy;
+    unsigned int next_seq;
+
+    //multi-producer/single-consumer submission stack, newest first
+    Task *intake;
+    int intake_count;
+
+    //contention counters for the stats line
+    unsigned long submitted;
+    unsigned long drain_batches;
+    unsigned long lock_acquired;
+    unsigned long lock_contended;
+} RunQueue;
+
+//first heap allocation; grows by doubling and is never shrunk
+#define HEAP_INITIAL_CAPACITY 16
+
+static RunQueue run_queues[MAX_WORKERS];
+static int worker_count = 1;
+
+//policy for new decisions; each run queue also keeps the one its heaps are
+//ordered by, which catches up under its own lock when this one is switched
+static const SchedPolicyOps *g_policy = &sched_policy_sjrf;
+
+//handed out with atomic increments so submitting takes no lock
+static int next_task_id = 1;
+static int next_arrival_order = 1;
 
-static Task *queue_head = NULL;
-static Task *queue_tail = NULL;
+//limit for tasks whose command does not set one (server -t), 0: none
+static int g_default_timeout_ms = 0;
 
-static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+void queue_set_default_timeout(int timeout_ms)
+{
+    g_default_timeout_ms = timeout_ms;
+}
 
-static int next_task_id = 1;
-static int next_arrival_order = 1;
+//splitting an "@timeout=N " prefix off a command
+//returns the command proper; *timeout_ms keeps its value without a prefix
+static const char *parse_timeout_prefix(const char *command, int *timeout_ms)
+{
+    char *endptr;
+    long seconds;
+
+    if (strncmp(command, "@timeout=", 9) != 0)
+    {
+        return command;
+    }
+
+    seconds = strtol(command + 9, &endptr, 10);
+
+    if (endptr == command + 9 || *endptr != ' ' || seconds < 0 || seconds > INT_MAX / 1000)
+    {
+        return command;
+    }
+
+    while (*endptr == ' ')
+    {
+        endptr++;
+    }
+
+    *timeout_ms = (int)seconds * 1000;
+
+    return endptr;
+}
 
 /* detect: demo N */
 static int parse_demo_command(const char *command, int *n_out)
@@ -36,13 +122,16 @@ Task *create_task_from_command(ClientContext *ctx, const char *command)
 {
     Task *task;
     int n = 0;
+    int timeout_ms = g_default_timeout_ms;
 
     if (ctx == NULL || command == NULL)
     {
         return NULL;
     }
 
-    task = (Task *)malloc(sizeof(Task));
+    command = parse_timeout_prefix(command, &timeout_ms);
+
+    task = (Task *)slab_alloc(sizeof(Task));
     if (task == NULL)
     {
         return NULL;
@@ -50,10 +139,8 @@ Task *create_task_from_command(ClientContext *ctx, const char *command)
 
     memset(task, 0, sizeof(Task));
 
-    pthread_mutex_lock(&queue_mutex);
-    task->task_id = next_task_id++;
-    task->arrival_order = next_arrival_order++;
-    pthread_mutex_unlock(&queue_mutex);
+    task->task_id = __atomic_fetch_add(&next_task_id, 1, __ATOMIC_RELAXED);
+    task->arrival_order = __atomic_fetch_add(&next_arrival_order, 1, __ATOMIC_RELAXED);
 
     task->client_id = ctx->client_id;
     task->client_fd = ctx->client_fd;
@@ -62,8 +149,14 @@ Task *create_task_from_command(ClientContext *ctx, const char *command)
     strncpy(task->client_ip, ctx->client_ip, sizeof(task->client_ip) - 1);
     task->client_ip[sizeof(task->client_ip) - 1] = '\0';
 
-    strncpy(task->command, command, sizeof(task->command) - 1);
-    task->command[sizeof(task->command) - 1] = '\0';
+    task->command = slab_strdup(command);
+    if (task->command == NULL)
+    {
+        slab_free(task, sizeof(Task));
+        return NULL;
+    }
+
+    task->proto = ctx->proto;
 
     if (parse_demo_command(command, &n))
     {
@@ -76,295 +169,1094 @@ Task *create_task_from_command(ClientContext *ctx, const char *command)
         task->type = TASK_SHELL;
         task->burst_time = -1;
         task->remaining_time = -1;
+        task->predicted_ms = burst_predict_ms(command);
     }
 
     task->round_count = 0;
+    task->output_fd = -1;
+
+    //the limit runs from submission, queueing included (0 means no deadline)
+    if (timeout_ms > 0)
+    {
+        task->deadline_ms = (unsigned int)timer_now_ms() + (unsigned int)timeout_ms;
+
+        if (task->deadline_ms == 0)
+        {
+            task->deadline_ms = 1;
+        }
+    }
     task->next = NULL;
 
     return task;
 }
 
-void enqueue_task(Task *task)
+void free_task(Task *task)
 {
     if (task == NULL)
     {
         return;
     }
 
-    pthread_mutex_lock(&queue_mutex);
+    //a shell command dropped while stopped takes its process group along
+    if (task->pid > 0)
+    {
+        kill(-task->pid, SIGKILL);
+        child_release(task->pid);
+    }
 
-    task->next = NULL;
+    if (task->output_fd >= 0)
+    {
+        close(task->output_fd);
+    }
 
-    if (queue_tail == NULL)
+    //both blocks go back to the slab of the thread that created the task
+    slab_free_string(task->command);
+    slab_free(task, sizeof(Task));
+}
+
+void queue_init(int workers)
+{
+    if (workers < 1)
     {
-        queue_head = task;
-        queue_tail = task;
+        workers = 1;
     }
-    else
+
+    if (workers > MAX_WORKERS)
     {
-        queue_tail->next = task;
-        queue_tail = task;
+        workers = MAX_WORKERS;
     }
 
-    pthread_cond_signal(&queue_not_empty);
-    pthread_mutex_unlock(&queue_mutex);
-    //notify scheduler that a new task arrived (may cause preemption)
-    //scheduler_notify_new_task is defined in scheduler.c
-    scheduler_notify_new_task(task);
+    worker_count = workers;
+
+    for (int i = 0; i < MAX_WORKERS; i++)
+    {
+        pthread_mutex_init(&run_queues[i].mutex, NULL);
+        run_queues[i].shells.items = NULL;
+        run_queues[i].shells.len = 0;
+        run_queues[i].shells.cap = 0;
+        run_queues[i].demos.items = NULL;
+        run_queues[i].demos.len = 0;
+        run_queues[i].demos.cap = 0;
+        run_queues[i].groups = NULL;
+        run_queues[i].length = 0;
+        run_queues[i].busy = 0;
+        run_queues[i].intake = NULL;
+        run_queues[i].intake_count = 0;
+        run_queues[i].policy = g_policy;
+        run_queues[i].next_seq = 0;
+    }
 }
 
-void enqueue_task_requeue(Task *task)
+//taking a run queue lock and counting whether it had to wait
+static void run_queue_lock(RunQueue *rq)
 {
-    if (task == NULL)
+    if (pthread_mutex_trylock(&rq->mutex) != 0)
+    {
+        pthread_mutex_lock(&rq->mutex);
+        rq->lock_contended++;
+    }
+
+    rq->lock_acquired++;
+}
+
+void queue_set_policy(const SchedPolicyOps *policy)
+{
+    g_policy = policy;
+}
+
+const SchedPolicyOps *queue_policy(void)
+{
+    return __atomic_load_n(&g_policy, __ATOMIC_ACQUIRE);
+}
+
+int queue_worker_count(void)
+{
+    return worker_count;
+}
+
+int queue_length(int worker)
+{
+    return run_queues[worker].length;
+}
+
+void queue_set_busy(int worker, int busy)
+{
+    //a plain store: every reader treats busy as a load hint
+    __atomic_store_n(&run_queues[worker].busy, busy, __ATOMIC_RELAXED);
+}
+
+/* ---------- demo heaps (caller holds rq->mutex) ---------- */
+//every heap operation takes the owning queue's policy order
+typedef int (*TaskOrder)(const Task *a, const Task *b);
+
+static void heap_place(TaskHeap *heap, int index, Task *task)
+{
+    heap->items[index] = task;
+    task->heap_index = index;
+}
+
+static void heap_sift_up(TaskHeap *heap, int index, TaskOrder before)
+{
+    Task *task = heap->items[index];
+
+    while (index > 0)
+    {
+        int parent = (index - 1) / 2;
+
+        if (!before(task, heap->items[parent]))
+        {
+            break;
+        }
+
+        heap_place(heap, index, heap->items[parent]);
+        index = parent;
+    }
+
+    heap_place(heap, index, task);
+}
+
+static void heap_sift_down(TaskHeap *heap, int index, TaskOrder before)
+{
+    Task *task = heap->items[index];
+
+    while (1)
+    {
+        int child = 2 * index + 1;
+
+        if (child >= heap->len)
+        {
+            break;
+        }
+
+        if (child + 1 < heap->len && before(heap->items[child + 1], heap->items[child]))
+        {
+            child++;
+        }
+
+        if (!before(heap->items[child], task))
+        {
+            break;
+        }
+
+        heap_place(heap, index, heap->items[child]);
+        index = child;
+    }
+
+    heap_place(heap, index, task);
+}
+
+//returns 0 on success, -1 when the heap cannot grow
+static int heap_push(TaskHeap *heap, Task *task, TaskOrder before)
+{
+    if (heap->len == heap->cap)
+    {
+        int cap = heap->cap ? heap->cap * 2 : HEAP_INITIAL_CAPACITY;
+        Task **grown = (Task **)realloc(heap->items, (size_t)cap * sizeof(Task *));
+
+        if (grown == NULL)
+        {
+            perror("realloc");
+            return -1;
+        }
+
+        heap->items = grown;
+        heap->cap = cap;
+    }
+
+    heap_place(heap, heap->len++, task);
+    heap_sift_up(heap, task->heap_index, before);
+
+    return 0;
+}
+
+static void heap_remove(TaskHeap *heap, Task *task, TaskOrder before)
+{
+    int index = task->heap_index;
+    Task *last = heap->items[--heap->len];
+
+    task->heap_index = -1;
+
+    if (last == task)
     {
         return;
     }
 
-    pthread_mutex_lock(&queue_mutex);
+    //the former last task fills the hole and moves whichever way it must
+    heap_place(heap, index, last);
+    heap_sift_up(heap, index, before);
+    heap_sift_down(heap, last->heap_index, before);
+}
+
+//restoring heap order after arbitrary removals (bottom-up, O(n))
+static void heap_rebuild(TaskHeap *heap, TaskOrder before)
+{
+    for (int i = 0; i < heap->len; i++)
+    {
+        heap->items[i]->heap_index = i;
+    }
+
+    for (int i = heap->len / 2 - 1; i >= 0; i--)
+    {
+        heap_sift_down(heap, i, before);
+    }
+}
+
+/* ---------- run queue (caller holds rq->mutex) ---------- */
+//finding (or, with create set, adding) a client's group on a run queue
+static ClientGroup *run_queue_group(RunQueue *rq, int client_id, int create)
+{
+    ClientGroup *group = rq->groups;
+
+    while (group != NULL && group->client_id != client_id)
+    {
+        group = group->next;
+    }
+
+    if (group == NULL && create)
+    {
+        group = (ClientGroup *)calloc(1, sizeof(ClientGroup));
+
+        if (group != NULL)
+        {
+            group->client_id = client_id;
+            group->next = rq->groups;
+            rq->groups = group;
+        }
+    }
+
+    return group;
+}
+
+//unlinking and freeing a client group whose heap is empty
+static void run_queue_drop_group(RunQueue *rq, ClientGroup *group)
+{
+    ClientGroup **link = &rq->groups;
+
+    while (*link != NULL && *link != group)
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link != NULL)
+    {
+        *link = group->next;
+    }
+
+    free(group->demos.items);
+    free(group);
+}
+
+//a shell command that has not run yet; one that already had a quantum
+//competes with the demos by the policy order
+static int in_shell_heap(const Task *task)
+{
+    return task->type == TASK_SHELL && task->round_count == 0;
+}
 
+//fresh shell commands go to the shell heap, everything else into the demo
+//heap (the client's own heap under a per-client policy)
+//returns 0 on success, -1 when the task could not be stored
+static int run_queue_append(RunQueue *rq, Task *task)
+{
     task->next = NULL;
+    task->run_seq = rq->next_seq++;
 
-    if (queue_tail == NULL)
+    if (in_shell_heap(task))
     {
-        queue_head = task;
-        queue_tail = task;
+        if (heap_push(&rq->shells, task, rq->policy->shell_before) < 0)
+        {
+            return -1;
+        }
+    }
+    else if (rq->policy->per_client)
+    {
+        ClientGroup *group = run_queue_group(rq, task->client_id, 1);
+
+        rq->policy->on_arrival(task);
+
+        if (group == NULL || heap_push(&group->demos, task, rq->policy->before) < 0)
+        {
+            return -1;
+        }
     }
     else
     {
-        queue_tail->next = task;
-        queue_tail = task;
+        rq->policy->on_arrival(task);
+
+        if (heap_push(&rq->demos, task, rq->policy->before) < 0)
+        {
+            return -1;
+        }
     }
 
-    pthread_cond_signal(&queue_not_empty);
-    pthread_mutex_unlock(&queue_mutex);
+    rq->length++;
+
+    return 0;
 }
 
-Task *dequeue_task(void)
+//unlinking a queued task in O(log n)
+static void run_queue_remove(RunQueue *rq, Task *task)
 {
-    Task *task;
+    if (!in_shell_heap(task) && rq->policy->per_client)
+    {
+        ClientGroup *group = run_queue_group(rq, task->client_id, 0);
 
-    pthread_mutex_lock(&queue_mutex);
+        heap_remove(&group->demos, task, rq->policy->before);
 
-    while (queue_head == NULL)
+        if (group->demos.len == 0)
+        {
+            run_queue_drop_group(rq, group);
+        }
+    }
+    else if (!in_shell_heap(task))
     {
-        pthread_cond_wait(&queue_not_empty, &queue_mutex);
+        heap_remove(&rq->demos, task, rq->policy->before);
+    }
+    else
+    {
+        heap_remove(&rq->shells, task, rq->policy->shell_before);
     }
 
-    task = queue_head;
-    queue_head = queue_head->next;
+    rq->length--;
+}
 
-    if (queue_head == NULL)
+/* ---------- intake ---------- */
+//pushing a chain of tasks (first..last already linked) with one CAS
+static void intake_push_chain(RunQueue *rq, Task *first, Task *last, int count)
+{
+    last->next = __atomic_load_n(&rq->intake, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&rq->intake, &last->next, first, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
     {
-        queue_tail = NULL;
     }
 
-    task->next = NULL;
+    __atomic_add_fetch(&rq->intake_count, count, __ATOMIC_RELAXED);
+}
 
-    pthread_mutex_unlock(&queue_mutex);
+//detaching everything submitted so far, oldest first; the whole stack is
+//taken by one exchange so there is no ABA window
+static Task *intake_take(RunQueue *rq)
+{
+    Task *list = __atomic_exchange_n(&rq->intake, NULL, __ATOMIC_ACQUIRE);
+    Task *sorted = NULL;
+    int count = 0;
+
+    //insertion by arrival_order: producers may push slightly out of order
+    //and queue_take_client_tasks pushes survivors back on top; the stack
+    //is newest first, so the common case inserts at the head in O(1)
+    while (list != NULL)
+    {
+        Task *task = list;
+        Task **link = &sorted;
 
-    return task;
+        list = list->next;
+
+        while (*link != NULL && (*link)->arrival_order < task->arrival_order)
+        {
+            link = &(*link)->next;
+        }
+
+        task->next = *link;
+        *link = task;
+        count++;
+    }
+
+    if (count > 0)
+    {
+        __atomic_sub_fetch(&rq->intake_count, count, __ATOMIC_RELAXED);
+    }
+
+    return sorted;
 }
 
-//removing specific task from queue by task_id
-//returns 1 if task was removed, 0 if not found  
-int dequeue_task_by_id(int task_id)
+//ending a task the run queue could not store, so it is not lost silently
+static void reject_task(Task *task)
 {
-    pthread_mutex_lock(&queue_mutex);
+    const char *msg = "Error: could not queue task\n";
 
-    Task *curr = queue_head;
-    Task *prev = NULL;
+    task->exit_status = 1;
+    send_client_output(task->client_fd, task->proto, task->task_id, msg, strlen(msg));
 
-    //finding the task with matching task_id
-    while (curr != NULL)
+    if (!dag_task_end(task))
+    {
+        send_client_end(task->client_fd, task->proto, task->task_id, 1);
+    }
+
+    free_task(task);
+}
+
+//rejects are replied to with no run queue lock held: the reply may wait
+//for the client's socket and may end a DAG node (which may submit more tasks)
+void queue_reject_tasks(Task *list)
+{
+    while (list != NULL)
     {
-        if (curr->task_id == task_id)
+        Task *next = list->next;
+
+        reject_task(list);
+        list = next;
+    }
+}
+
+//moving submitted tasks into the run queue (caller holds rq->mutex); any
+//the run queue cannot store are chained onto *rejected for the caller to
+//reject once it dropped the lock
+//returns 1 when one of them should preempt current (null: never)
+static int intake_drain_locked(RunQueue *rq, Task *current, Task **rejected)
+{
+    Task *task = intake_take(rq);
+    int preempt = 0;
+
+    if (task == NULL)
+    {
+        return 0;
+    }
+
+    rq->drain_batches++;
+
+    while (task != NULL)
+    {
+        Task *next = task->next;
+
+        if (current != NULL && scheduler_should_preempt(task, current))
         {
-            //found it - removing from queue
-            if (prev == NULL)
-            {
-                //removing from head
-                queue_head = curr->next;
-            }
-            else
-            {
-                //removing from middle
-                prev->next = curr->next;
-            }
+            preempt = 1;
+        }
 
-            //updating tail if necessary
-            if (queue_tail == curr)
-            {
-                queue_tail = prev;
-            }
+        if (run_queue_append(rq, task) < 0)
+        {
+            task->next = *rejected;
+            *rejected = task;
+        }
+
+        task = next;
+    }
+
+    return preempt;
+}
 
-            curr->next = NULL;
+//choosing the worker with the fewest queued plus running tasks; the load is
+//read without locks, a slightly stale answer only costs balance
+static int pick_target_worker(void)
+{
+    int best = 0;
+    int best_load = -1;
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        int load = run_queues[i].length + run_queues[i].busy +
+                   __atomic_load_n(&run_queues[i].intake_count, __ATOMIC_RELAXED);
 
-            pthread_mutex_unlock(&queue_mutex);
-            return 1;
+        if (best_load < 0 || load < best_load)
+        {
+            best = i;
+            best_load = load;
         }
+    }
+
+    return best;
+}
 
-        prev = curr;
-        curr = curr->next;
+int enqueue_task(Task *task)
+{
+    RunQueue *rq;
+    int worker;
+
+    if (task == NULL)
+    {
+        return -1;
     }
 
-    //task not found
-    pthread_mutex_unlock(&queue_mutex);
+    worker = pick_target_worker();
+    rq = &run_queues[worker];
+
+    task->worker = worker;
+    task->queued_ms = (unsigned int)timer_now_ms();
+    task->submitted_ms = task->queued_ms;
+    __atomic_add_fetch(&rq->submitted, 1, __ATOMIC_RELAXED);
+
+    //no lock on the submission path; once pushed the task may already be
+    //running (or finished), so only the worker index is used afterwards
+    intake_push_chain(rq, task, task, 1);
+
+    //wake the owner, which drains its intake and decides on preemption
+    //scheduler_notify_new_task is defined in scheduler.c
+    scheduler_notify_new_task(worker);
+
     return 0;
 }
 
-//returning best task based on SJRF priority (without removing it)
-Task *peek_best_task_sjrf(int last_selected_task_id)
+int enqueue_task_requeue(Task *task)
 {
-    pthread_mutex_lock(&queue_mutex);
+    RunQueue *rq;
+    int worker;
+    int rc;
 
-    Task *selected = NULL;
-    Task *curr = queue_head;
+    if (task == NULL)
+    {
+        return -1;
+    }
 
-    //pass 1: looking for shell commands (highest priority)
-    while (curr != NULL)
+    worker = task->worker;
+    rq = &run_queues[worker];
+    task->queued_ms = (unsigned int)timer_now_ms();
+
+    run_queue_lock(rq);
+    rc = run_queue_append(rq, task);
+    pthread_mutex_unlock(&rq->mutex);
+
+    if (rc < 0)
     {
-        if (curr->type == TASK_SHELL && curr->burst_time == -1)
-        {
-            selected = curr;
-            pthread_mutex_unlock(&queue_mutex);
-            return selected;
-        }
-        curr = curr->next;
+        return -1;
     }
 
-    //pass 2: looking for demo with shortest remaining time
-    //using FCFS (arrival_order) for tie-breaking
+    //an idle peer may steal the requeued task
+    scheduler_wake_owner(worker);
+
+    return 0;
+}
 
-    //count demo tasks so we only skip last_selected when there is
-    //more than one demo task in the queue
-    int demo_count = 0;
-    curr = queue_head;
-    while (curr != NULL)
+//returning the next task of a run queue (caller holds rq->mutex): the first
+//shell command in policy order, otherwise whatever demo the policy picks
+static Task *select_next(RunQueue *rq, int last_selected_task_id)
+{
+    if (rq->shells.len > 0)
     {
-        if (curr->type == TASK_DEMO_PROGRAM)
-            demo_count++;
-        curr = curr->next;
+        return rq->shells.items[0];
     }
 
-    int shortest_time = INT_MAX;
-    curr = queue_head;
+    return rq->policy->pick_next(&rq->demos, rq->groups, last_selected_task_id);
+}
+
+//returning the first task of a run queue for which match returns non-zero,
+//or null (caller holds rq->mutex)
+static Task *run_queue_find(RunQueue *rq, int (*match)(const Task *task, void *arg), void *arg)
+{
+    for (int i = 0; i < rq->shells.len; i++)
+    {
+        if (match(rq->shells.items[i], arg))
+        {
+            return rq->shells.items[i];
+        }
+    }
 
-    while (curr != NULL)
+    for (int i = 0; i < rq->demos.len; i++)
     {
-        if (curr->type == TASK_DEMO_PROGRAM)
+        if (match(rq->demos.items[i], arg))
         {
-            //skip the previously selected task only when another demo
-            //task exists; if it is the sole demo task, allow reselection
-            if (curr->task_id == last_selected_task_id && demo_count > 1)
-            {
-                curr = curr->next;
-                continue;
-            }
+            return rq->demos.items[i];
+        }
+    }
 
-            //selecting if shorter, or same time but earlier arrival
-            if (selected == NULL ||
-                curr->remaining_time < shortest_time ||
-                (curr->remaining_time == shortest_time && curr->arrival_order < selected->arrival_order))
+    for (ClientGroup *group = rq->groups; group != NULL; group = group->next)
+    {
+        for (int i = 0; i < group->demos.len; i++)
+        {
+            if (match(group->demos.items[i], arg))
             {
-                shortest_time = curr->remaining_time;
-                selected = curr;
+                return group->demos.items[i];
             }
         }
-        curr = curr->next;
     }
 
-    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+Task *dequeue_task(void)
+{
+    for (int i = 0; i < worker_count; i++)
+    {
+        RunQueue *rq = &run_queues[i];
+        Task *task;
+
+        run_queue_lock(rq);
+
+        task = select_next(rq, -1);
+
+        if (task != NULL)
+        {
+            run_queue_remove(rq, task);
+        }
+
+        pthread_mutex_unlock(&rq->mutex);
+
+        if (task != NULL)
+        {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+static int task_has_id(const Task *task, void *arg)
+{
+    return task->task_id == *(const int *)arg;
+}
+
+//removing specific task from a worker's run queue by task_id
+//returns 1 if task was removed, 0 if not found
+int dequeue_task_by_id(int worker, int task_id)
+{
+    RunQueue *rq = &run_queues[worker];
+    Task *found = NULL;
+
+    run_queue_lock(rq);
+
+    //finding the task with matching task_id
+    found = run_queue_find(rq, task_has_id, &task_id);
+
+    if (found != NULL)
+    {
+        run_queue_remove(rq, found);
+    }
+
+    pthread_mutex_unlock(&rq->mutex);
+
+    return found != NULL;
+}
+
+Task *peek_next_task(int worker, int last_selected_task_id)
+{
+    RunQueue *rq = &run_queues[worker];
+    Task *selected;
+    Task *rejected = NULL;
+
+    run_queue_lock(rq);
+    intake_drain_locked(rq, NULL, &rejected);
+    selected = select_next(rq, last_selected_task_id);
+    pthread_mutex_unlock(&rq->mutex);
+
+    queue_reject_tasks(rejected);
+
     return selected;
 }
 
-void remove_tasks_for_client(int client_id)
+void queue_visit(int worker, void (*visit)(const Task *task, void *arg), void *arg)
+{
+    RunQueue *rq = &run_queues[worker];
+
+    run_queue_lock(rq);
+
+    for (int i = 0; i < rq->shells.len; i++)
+    {
+        visit(rq->shells.items[i], arg);
+    }
+
+    for (int i = 0; i < rq->demos.len; i++)
+    {
+        visit(rq->demos.items[i], arg);
+    }
+
+    for (ClientGroup *group = rq->groups; group != NULL; group = group->next)
+    {
+        for (int i = 0; i < group->demos.len; i++)
+        {
+            visit(group->demos.items[i], arg);
+        }
+    }
+
+    pthread_mutex_unlock(&rq->mutex);
+}
+
+Task *pop_next_task(int worker, int last_selected_task_id, Task **rejected)
+{
+    RunQueue *rq = &run_queues[worker];
+    Task *selected;
+
+    run_queue_lock(rq);
+
+    //the idle owner pulls in new submissions under the same lock hold
+    intake_drain_locked(rq, NULL, rejected);
+
+    selected = select_next(rq, last_selected_task_id);
+
+    if (selected != NULL)
+    {
+        run_queue_remove(rq, selected);
+    }
+
+    pthread_mutex_unlock(&rq->mutex);
+
+    return selected;
+}
+
+int queue_drain_intake(int worker, Task *current)
+{
+    RunQueue *rq = &run_queues[worker];
+    Task *rejected = NULL;
+    int preempt;
+
+    //cheap check first: a running slice wakes up for every submission
+    if (__atomic_load_n(&rq->intake, __ATOMIC_RELAXED) == NULL)
+    {
+        return 0;
+    }
+
+    run_queue_lock(rq);
+    preempt = intake_drain_locked(rq, current, &rejected);
+    pthread_mutex_unlock(&rq->mutex);
+
+    queue_reject_tasks(rejected);
+
+    return preempt;
+}
+
+Task *steal_task(int thief)
+{
+    int victim = -1;
+    int victim_load = 0;
+    Task *stolen = NULL;
+
+    //picking the peer with the most surplus work: everything queued behind
+    //a busy worker, or all but one task of an idle one (it will run that)
+    for (int i = 0; i < worker_count; i++)
+    {
+        int surplus;
+
+        if (i == thief)
+        {
+            continue;
+        }
+
+        surplus = run_queues[i].length - (run_queues[i].busy ? 0 : 1);
+
+        if (surplus > victim_load)
+        {
+            victim = i;
+            victim_load = surplus;
+        }
+    }
+
+    if (victim < 0)
+    {
+        return NULL;
+    }
+
+    run_queue_lock(&run_queues[victim]);
+
+    //the victim's own next choice is the task that waits longest for it
+    if (run_queues[victim].length - (run_queues[victim].busy ? 0 : 1) > 0)
+    {
+        stolen = select_next(&run_queues[victim], -1);
+
+        if (stolen != NULL)
+        {
+            run_queue_remove(&run_queues[victim], stolen);
+            stolen->worker = thief;
+        }
+    }
+
+    pthread_mutex_unlock(&run_queues[victim].mutex);
+
+    return stolen;
+}
+
+//a queued task the removal below is after: any of the client's tasks, or
+//only the one with task_id (when positive)
+static int task_is_taken(const Task *task, int client_id, int task_id)
 {
-    Task *curr;
-    Task *prev;
+    return task->client_id == client_id && (task_id <= 0 || task->task_id == task_id);
+}
+
+//moving a heap's matching tasks onto *taken by compacting its array in
+//place, then restoring its order once (caller holds the queue's mutex)
+//returns the number of tasks moved
+static int heap_take_matching(TaskHeap *heap, int client_id, int task_id,
+                              TaskOrder before, Task **taken)
+{
+    int kept = 0;
+    int removed;
+
+    for (int j = 0; j < heap->len; j++)
+    {
+        Task *task = heap->items[j];
+
+        if (task_is_taken(task, client_id, task_id))
+        {
+            task->next = *taken;
+            *taken = task;
+        }
+        else
+        {
+            heap->items[kept++] = task;
+        }
+    }
 
-    pthread_mutex_lock(&queue_mutex);
+    removed = heap->len - kept;
 
-    curr = queue_head;
-    prev = NULL;
+    if (removed > 0)
+    {
+        heap->len = kept;
+        heap_rebuild(heap, before);
+    }
+
+    return removed;
+}
 
-    while (curr != NULL)
+Task *queue_take_client_tasks(int client_id, int task_id)
+{
+    Task *taken = NULL;
+
+    for (int i = 0; i < worker_count; i++)
     {
-        if (curr->client_id == client_id)
+        RunQueue *rq = &run_queues[i];
+        Task *curr;
+        ClientGroup *group;
+        Task *survivors = NULL;
+        Task *survivors_tail = NULL;
+        int survivor_count = 0;
+
+        //submissions not drained yet: take this client's, hand the rest back
+        //to the owner (which still runs the preemption check on them)
+        curr = intake_take(rq);
+
+        while (curr != NULL)
         {
-            Task *to_delete = curr;
+            Task *next = curr->next;
 
-            if (prev == NULL)
+            if (task_is_taken(curr, client_id, task_id))
             {
-                queue_head = curr->next;
-                curr = queue_head;
+                curr->next = taken;
+                taken = curr;
             }
             else
             {
-                prev->next = curr->next;
-                curr = prev->next;
+                curr->next = NULL;
+
+                if (survivors_tail == NULL)
+                {
+                    survivors = curr;
+                }
+                else
+                {
+                    survivors_tail->next = curr;
+                }
+
+                survivors_tail = curr;
+                survivor_count++;
             }
 
-            if (to_delete == queue_tail)
+            curr = next;
+        }
+
+        //handed back like fresh submissions, so the owner is woken the same
+        //way: it may have gone idle while its intake was detached here
+        if (survivors != NULL)
+        {
+            intake_push_chain(rq, survivors, survivors_tail, survivor_count);
+            scheduler_notify_new_task(i);
+        }
+
+        run_queue_lock(rq);
+
+        rq->length -= heap_take_matching(&rq->shells, client_id, task_id,
+                                         rq->policy->shell_before, &taken);
+        rq->length -= heap_take_matching(&rq->demos, client_id, task_id,
+                                         rq->policy->before, &taken);
+
+        //under a per-client policy the client's tasks form one group, which
+        //goes once it is empty
+        group = run_queue_group(rq, client_id, 0);
+
+        if (group != NULL)
+        {
+            rq->length -= heap_take_matching(&group->demos, client_id, task_id,
+                                             rq->policy->before, &taken);
+
+            if (group->demos.len == 0)
             {
-                queue_tail = prev;
+                run_queue_drop_group(rq, group);
             }
+        }
+
+        pthread_mutex_unlock(&rq->mutex);
+    }
+
+    return taken;
+}
+
+//queue entry order, robust to run_seq wrapping around
+static int compare_run_seq(const void *a, const void *b)
+{
+    const Task *ta = *(Task *const *)a;
+    const Task *tb = *(Task *const *)b;
+
+    return (int)(ta->run_seq - tb->run_seq);
+}
+
+void queue_switch_policy(const SchedPolicyOps *policy)
+{
+    __atomic_store_n(&g_policy, policy, __ATOMIC_RELEASE);
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        RunQueue *rq = &run_queues[i];
+        Task **moved;
+        Task *rejected = NULL;
+        int count = 0;
 
-            free(to_delete);
+        run_queue_lock(rq);
+
+        if (rq->policy == policy)
+        {
+            pthread_mutex_unlock(&rq->mutex);
+            continue;
         }
-        else
+
+        moved = (Task **)malloc((size_t)(rq->length + 1) * sizeof(Task *));
+
+        if (moved == NULL)
+        {
+            //the queue stays consistently ordered by its old policy
+            perror("malloc");
+            pthread_mutex_unlock(&rq->mutex);
+            continue;
+        }
+
+        //unfiling every demo task, then filing them again in their previous
+        //queue order so FIFO policies keep the waiting line intact
+        for (int j = 0; j < rq->demos.len; j++)
         {
-            prev = curr;
-            curr = curr->next;
+            moved[count++] = rq->demos.items[j];
         }
+
+        rq->demos.len = 0;
+
+        while (rq->groups != NULL)
+        {
+            ClientGroup *group = rq->groups;
+
+            for (int j = 0; j < group->demos.len; j++)
+            {
+                moved[count++] = group->demos.items[j];
+            }
+
+            run_queue_drop_group(rq, group);
+        }
+
+        qsort(moved, (size_t)count, sizeof(Task *), compare_run_seq);
+
+        rq->policy = policy;
+        rq->length -= count;
+
+        heap_rebuild(&rq->shells, policy->shell_before);
+
+        for (int j = 0; j < count; j++)
+        {
+            //MLFQ levels restart from the top, as after a priority boost
+            moved[j]->level = 0;
+
+            //rejected once the lock is dropped (see queue_reject_tasks)
+            if (run_queue_append(rq, moved[j]) < 0)
+            {
+                moved[j]->next = rejected;
+                rejected = moved[j];
+            }
+        }
+
+        pthread_mutex_unlock(&rq->mutex);
+
+        free(moved);
+        queue_reject_tasks(rejected);
     }
+}
 
-    if (queue_head == NULL)
+int queue_is_empty(void)
+{
+    int empty = 1;
+
+    for (int i = 0; i < worker_count && empty; i++)
     {
-        queue_tail = NULL;
+        run_queue_lock(&run_queues[i]);
+        empty = (run_queues[i].length == 0 &&
+                 __atomic_load_n(&run_queues[i].intake, __ATOMIC_RELAXED) == NULL);
+        pthread_mutex_unlock(&run_queues[i].mutex);
     }
 
-    pthread_mutex_unlock(&queue_mutex);
+    return empty;
 }
 
-int queue_is_empty(void)
+int queue_find_idle_worker(int owner)
 {
-    int empty;
+    //lock-free read like pick_target_worker: a stale answer only costs one
+    //spurious wakeup or one missed steal
+    if (!run_queues[owner].busy)
+    {
+        return -1;
+    }
 
-    pthread_mutex_lock(&queue_mutex);
-    empty = (queue_head == NULL);
-    pthread_mutex_unlock(&queue_mutex);
+    for (int i = 0; i < worker_count; i++)
+    {
+        if (i != owner && !run_queues[i].busy && run_queues[i].length == 0 &&
+            __atomic_load_n(&run_queues[i].intake, __ATOMIC_RELAXED) == NULL)
+        {
+            return i;
+        }
+    }
 
-    return empty;
+    return -1;
 }
 
-void print_queue_snapshot(void)
+int queue_pool_idle(void)
 {
-    Task *curr;
+    int idle = 1;
+
+    for (int i = 0; i < worker_count && idle; i++)
+    {
+        run_queue_lock(&run_queues[i]);
+        idle = (run_queues[i].length == 0 && !run_queues[i].busy &&
+                __atomic_load_n(&run_queues[i].intake, __ATOMIC_RELAXED) == NULL);
+        pthread_mutex_unlock(&run_queues[i].mutex);
+    }
 
-    pthread_mutex_lock(&queue_mutex);
+    return idle;
+}
 
+static void log_queued_task(const Task *task, void *arg)
+{
+    log_printf_locked(
+        "[QUEUE] Task #%d | Client #%d | Worker #%d | cmd=\"%s\" | burst=%d | remaining=%d | round=%d\n",
+        task->task_id,
+        task->client_id,
+        *(const int *)arg,
+        task->command,
+        task->burst_time,
+        task->remaining_time,
+        task->round_count);
+}
+
+void print_queue_snapshot(void)
+{
     log_printf_locked("[QUEUE] Current waiting queue:\n");
 
-    if (queue_head == NULL)
+    if (queue_is_empty())
     {
         log_printf_locked("[QUEUE]   empty\n");
     }
 
-    curr = queue_head;
+    for (int i = 0; i < worker_count; i++)
+    {
+        queue_visit(i, log_queued_task, &i);
+    }
+}
 
-    while (curr != NULL)
+void queue_log_stats(void)
+{
+    for (int i = 0; i < worker_count; i++)
     {
-        log_printf_locked(
-            "[QUEUE] Task #%d | Client #%d | cmd=\"%s\" | burst=%d | remaining=%d | round=%d\n",
-            curr->task_id,
-            curr->client_id,
-            curr->command,
-            curr->burst_time,
-            curr->remaining_time,
-            curr->round_count);
+        RunQueue *rq = &run_queues[i];
+        unsigned long submitted = __atomic_load_n(&rq->submitted, __ATOMIC_RELAXED);
 
-        curr = curr->next;
+        //counters are read without the lock: a report, not a snapshot
+        log_printf_locked(
+            "[STATS] Worker #%d | submitted=%lu | drain batches=%lu | run-queue locks=%lu (%lu contended) | locks/task=%.2f\n",
+            i,
+            submitted,
+            rq->drain_batches,
+            rq->lock_acquired,
+            rq->lock_contended,
+            submitted ? (double)rq->lock_acquired / (double)submitted : 0.0);
     }
-
-    pthread_mutex_unlock(&queue_mutex);
 }
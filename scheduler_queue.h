@@ -3,6 +3,12 @@
 
 #include "server_shared.h"
 
+#include <stdint.h>
+#include <sys/types.h>
+
+//upper bound for the executor pool size (server -w)
+#define MAX_WORKERS 64
+
 typedef enum
 {
     TASK_SHELL,
@@ -10,46 +16,167 @@ typedef enum
     TASK_UNKNOWN_PROGRAM
 } TaskType;
 
+//tasks come from the slab allocator (128-byte class, whose blocks are
+//line aligned): the fields read by scheduling decisions fill the first
+//cache line; the command, client address and accounting fields follow
 typedef struct Task
 {
+    struct Task *next;     // intake link
     int task_id;
+    TaskType type;
+    int remaining_time;    // used by scheduler
+    int arrival_order;     // FCFS tie-breaker
+    unsigned int run_seq;  // order of its latest entry into a run queue
+    int heap_index;        // slot in its run queue heap
+    int predicted_ms;      // shell commands: runtime predicted from history
+
+    int worker;            // executor whose run queue owns this task
+    int burst_time;        // predicted burst
+    int round_count;       // how many rounds executed
+    int slice_elapsed_ms;  // part of the current 1 s demo slice already served
 
     int client_id;
     int client_fd;
-    int client_port;
+    unsigned short client_port;
+    unsigned char proto;   // client's negotiated protocol (PROTO_TEXT/FRAMED)
+    unsigned char level;   // MLFQ priority level, 0 highest
     char client_ip[INET_ADDRSTRLEN];
+    unsigned int queued_ms;  // when it last entered a run queue (wait stats)
+    unsigned int submitted_ms; // when it was submitted (aging, response time)
 
-    char command[BUFFER_SIZE];
-
-    TaskType type;
-
-    int burst_time;        // predicted burst
-    int remaining_time;    // used by scheduler
-    int round_count;       // how many rounds executed
-    int arrival_order;     // FCFS tie-breaker
+    char *command;         // slab copy, any length (framed clients); never
+                           // shortened, its strlen sizes the free
 
     int bytes_sent;        // total real output bytes sent to this client
+    int exit_status;       // reported to framed clients in FRAME_END
 
-    struct Task *next;
+    uint64_t served_ns;    // service received so far
+    pid_t pid;             // started child's process group, else 0
+    int output_fd;         // its output pipe (read end), else -1
+    unsigned int deadline_ms;  // when it is killed (timer_now_ms, low 32 bits), 0: never
+    int boost_ms;          // interactive boost: ms of service it runs ahead of batch work, 0: batch
 } Task;
 
+// binary min-heap of tasks in a policy's order; each task's slot is
+// mirrored in task->heap_index
+typedef struct
+{
+    Task **items;
+    int len;
+    int cap;
+} TaskHeap;
+
+// a client's demo tasks on one run queue (per-client policies only)
+typedef struct ClientGroup
+{
+    int client_id;
+    TaskHeap demos;
+    struct ClientGroup *next;
+} ClientGroup;
+
+struct SchedPolicyOps;
+
+// creating a task for a client's command; an "@timeout=N " prefix (seconds,
+// 0 for none) overrides the default timeout and is not part of the command
 Task *create_task_from_command(ClientContext *ctx, const char *command);
 
-void enqueue_task(Task *task);
-void enqueue_task_requeue(Task *task);
+// releasing a task and its command storage; a started shell command's
+// process group is killed and reaped and its output pipe closed
+void free_task(Task *task);
+
+// setting the wall-clock limit of tasks without their own (0: none)
+void queue_set_default_timeout(int timeout_ms);
+
+// choosing the policy run queues start with (before queue_init)
+void queue_set_policy(const struct SchedPolicyOps *policy);
+
+// returns the policy new scheduling decisions follow
+const struct SchedPolicyOps *queue_policy(void);
+
+// switching every run queue to another policy while the pool runs: queued
+// tasks are re-filed in the new order, running ones follow it from their
+// next requeue
+void queue_switch_policy(const struct SchedPolicyOps *policy);
+
+// creating one run queue per executor worker (called once at startup)
+void queue_init(int workers);
+
+int queue_worker_count(void);
+
+// returns how many tasks wait on a worker's run queue (a lock-free snapshot
+// that may be stale, for statistics)
+int queue_length(int worker);
+
+// marking a worker as running a task (steers new arrivals to idle workers)
+void queue_set_busy(int worker, int busy);
+
+// submitting a new task to the least loaded worker without taking a lock:
+// it is pushed onto that worker's intake and moved into the run queue when
+// the worker drains it (a task the run queue cannot store is then ended
+// with an error); the task must not be touched after this call
+// returns 0 on success, -1 for a null task
+int enqueue_task(Task *task);
+
+// putting a task back on the run queue of its worker (task->worker)
+// returns 0 on success, -1 when the queue could not grow (task not queued)
+int enqueue_task_requeue(Task *task);
+
+// popping the best task (the policy's first shell command, else its first
+// demo) from the first non-empty run queue (undrained submissions are not considered)
+// returns null when every run queue is empty
 Task *dequeue_task(void);
 
-// removing specific task from queue based on task_id
+// removing specific task from a worker's run queue based on task_id
 // returns 1 if task was found and removed, 0 if not found
-int dequeue_task_by_id(int task_id);
+int dequeue_task_by_id(int worker, int task_id);
+
+// returning the task the active policy would run next on a worker without
+// removing it (pending submissions are drained first); caller should call
+// dequeue_task_by_id to remove it
+Task *peek_next_task(int worker, int last_selected_task_id);
+
+// calling visit for every task queued on a worker (shell commands, then
+// demos, each in heap array order) under a single lock acquisition; visit
+// must not modify the task or call back into the queue
+void queue_visit(int worker, void (*visit)(const Task *task, void *arg), void *arg);
+
+// selecting (by the active policy) and unlinking the next task under a
+// single lock hold (pending submissions are drained first); submissions the
+// run queue cannot store are chained onto *rejected for the caller to pass
+// to queue_reject_tasks once it holds no dispatch lock
+// returns null if the worker's run queue has no runnable task
+Task *pop_next_task(int worker, int last_selected_task_id, Task **rejected);
+
+// ending tasks chained through next that could not be queued: each gets an
+// error and its end of response; call with no queue or dispatch lock held
+void queue_reject_tasks(Task *list);
+
+// moving a worker's pending submissions into its run queue in one batch;
+// called by the worker while current runs
+// returns 1 when a new task should preempt current, 0 otherwise
+int queue_drain_intake(int worker, Task *current);
+
+// taking the best task from the busiest peer run queue for an idle worker
+// returns null when no peer has work to spare
+Task *steal_task(int thief);
+
+// taking a client's queued tasks (submitted or on a run queue) out of the
+// queues: all of them, or with task_id > 0 only that one; running tasks are
+// not touched
+// returns the removed tasks chained through next (null: none)
+Task *queue_take_client_tasks(int client_id, int task_id);
+
+int queue_is_empty(void);
 
-// returning best task in queue based on SJRF priority without removing
-// caller should call dequeue_task_by_id to actually remove it
-Task *peek_best_task_sjrf(int last_selected_task_id);
+// returns 1 when every run queue is empty and no worker is running a task
+int queue_pool_idle(void);
 
-void remove_tasks_for_client(int client_id);
+// logging per-worker submission and run-queue lock counters
+void queue_log_stats(void);
 
-int queue_is_empty(void);
+// finding a worker with nothing to do that could steal from a busy owner
+// returns -1 when owner is idle itself or no such peer exists
+int queue_find_idle_worker(int owner);
 
 void print_queue_snapshot(void);
 
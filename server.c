@@ -2,8 +2,18 @@
 #include "server_shared.h"
 #include "scheduler_queue.h"
 #include "scheduler.h"
+#include "sched_policy.h"
+#include "reactor.h"
+#include "uring.h"
+#include "fair_share.h"
+#include "burst_predictor.h"
+#include "quantum_controller.h"
+#include "timer_wheel.h"
+#include "child_manager.h"
+#include "dag.h"
 
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
@@ -14,11 +24,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 
 #define PORT 8080
 #define MAX_PORT_TRIES 20
 #define PORT_HINT_FILE ".myshell_port"
 
+//per-command runtime averages kept across restarts
+#define BURST_HISTORY_FILE ".myshell_bursts"
+
+//executor workers when -w is not given (1 keeps the classic single-CPU trace)
+#define DEFAULT_WORKERS 1
+
 /* global mutex for logs */
 static pthread_mutex_t g_log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -31,6 +49,13 @@ static int g_next_client_id = 1;
 /* stable log fd */
 static int g_server_log_fd = -1;
 
+/* MYSHELL_STATS set: log queue counters with every idle summary */
+static int g_log_stats = 0;
+
+/* -T ms: trace entries carry the pool's demo service in ms instead of the
+   whole slices it ran (the second-based compatibility trace, the default) */
+static int g_trace_ms = 0;
+
 /* ---------- logging ---------- */
 void log_printf_locked(const char *fmt, ...)
 {
@@ -67,24 +92,160 @@ static void handle_sigint(int sig)
 }
 
 /* ---------- send helpers ---------- */
+//client sockets are non-blocking (owned by the network backend), so a full
+//socket buffer waits for POLLOUT instead of failing the send
+int send_allv_plain(int sockfd, const struct iovec *iov, int iovcnt)
+{
+    for (int i = 0; i < iovcnt; i++)
+    {
+        const char *buffer = (const char *)iov[i].iov_base;
+        size_t length = iov[i].iov_len;
+        size_t sent = 0;
+
+        while (sent < length)
+        {
+            ssize_t n = send(sockfd, buffer + sent, length - sent, MSG_NOSIGNAL);
+
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    //a worker gives up on a client that stopped reading
+                    //once its task is cancelled or timed out
+                    if (scheduler_wait_writable(sockfd) < 0)
+                    {
+                        return -1;
+                    }
+
+                    continue;
+                }
+
+                perror("send");
+                return -1;
+            }
+
+            sent += (size_t)n;
+        }
+    }
+
+    return 0;
+}
+
+int send_allv(int sockfd, const struct iovec *iov, int iovcnt)
+{
+    if (uring_active())
+    {
+        return uring_send_linked(sockfd, iov, iovcnt);
+    }
+
+    return send_allv_plain(sockfd, iov, iovcnt);
+}
+
 int send_all(int sockfd, const char *buffer, size_t length)
 {
-    size_t sent = 0;
+    struct iovec iov;
+
+    iov.iov_base = (void *)buffer;
+    iov.iov_len = length;
+
+    return send_allv(sockfd, &iov, 1);
+}
+
+/* ---------- per-client send locks ---------- */
+//whoever writes to a client (its session thread, the workers running its
+//tasks, its DAGs) holds the client's send lock for a whole frame, header
+//and payload, so frames never interleave on the socket. Locks are found by
+//socket descriptor: one descriptor belongs to one client at a time, as
+//session_close waits for the client's workers before closing it. They are
+//recursive so a frame sender may use the helpers below while holding one
+#define SEND_LOCK_CHUNK 1024
+#define SEND_LOCK_CHUNKS 1024
+
+//chunks of SEND_LOCK_CHUNK locks, allocated as descriptors reach them
+//and never freed
+static pthread_mutex_t *g_send_locks[SEND_LOCK_CHUNKS];
+static pthread_mutex_t g_send_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//making sure a send lock exists for a new client's descriptor
+//returns 0 on success, -1 when the descriptor is out of range or memory
+//ran out
+static int send_lock_prepare(int client_fd)
+{
+    pthread_mutex_t *chunk;
+    pthread_mutexattr_t attr;
+
+    if (client_fd < 0 || client_fd >= SEND_LOCK_CHUNK * SEND_LOCK_CHUNKS)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_send_locks_mutex);
 
-    while (sent < length)
+    chunk = g_send_locks[client_fd / SEND_LOCK_CHUNK];
+
+    if (chunk == NULL)
     {
-        ssize_t n = send(sockfd, buffer + sent, length - sent, 0);
+        chunk = (pthread_mutex_t *)malloc(SEND_LOCK_CHUNK * sizeof(pthread_mutex_t));
 
-        if (n < 0)
+        if (chunk != NULL)
         {
-            perror("send");
-            return -1;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+            for (int i = 0; i < SEND_LOCK_CHUNK; i++)
+            {
+                pthread_mutex_init(&chunk[i], &attr);
+            }
+
+            pthread_mutexattr_destroy(&attr);
+
+            //published after its locks are set up: senders read it unlocked
+            __atomic_store_n(&g_send_locks[client_fd / SEND_LOCK_CHUNK], chunk, __ATOMIC_RELEASE);
         }
+    }
+
+    pthread_mutex_unlock(&g_send_locks_mutex);
+
+    return chunk != NULL ? 0 : -1;
+}
+
+static pthread_mutex_t *send_lock_find(int client_fd)
+{
+    pthread_mutex_t *chunk;
 
-        sent += (size_t)n;
+    if (client_fd < 0 || client_fd >= SEND_LOCK_CHUNK * SEND_LOCK_CHUNKS)
+    {
+        return NULL;
     }
 
-    return 0;
+    chunk = __atomic_load_n(&g_send_locks[client_fd / SEND_LOCK_CHUNK], __ATOMIC_ACQUIRE);
+
+    return chunk != NULL ? &chunk[client_fd % SEND_LOCK_CHUNK] : NULL;
+}
+
+void client_send_lock(int client_fd)
+{
+    pthread_mutex_t *lock = send_lock_find(client_fd);
+
+    if (lock != NULL)
+    {
+        pthread_mutex_lock(lock);
+    }
+}
+
+void client_send_unlock(int client_fd)
+{
+    pthread_mutex_t *lock = send_lock_find(client_fd);
+
+    if (lock != NULL)
+    {
+        pthread_mutex_unlock(lock);
+    }
 }
 
 int send_end_marker(int client_fd)
@@ -95,6 +256,83 @@ int send_end_marker(int client_fd)
     return strlen(END_MARKER);
 }
 
+static void encode_output_header(int task_id, size_t length, unsigned char *encoded)
+{
+    FrameHeader header;
+
+    memset(&header, 0, sizeof(header));
+    header.version = PROTO_VERSION;
+    header.type = FRAME_OUTPUT;
+    header.task_id = (uint32_t)task_id;
+    header.length = (uint32_t)length;
+    frame_encode(&header, encoded);
+}
+
+int send_output_header(int client_fd, int task_id, size_t length)
+{
+    unsigned char encoded[FRAME_HEADER_SIZE];
+
+    encode_output_header(task_id, length, encoded);
+
+    return send_all(client_fd, (const char *)encoded, sizeof(encoded));
+}
+
+int send_client_output(int client_fd, int proto, int task_id, const char *buffer, size_t length)
+{
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    struct iovec iov[2];
+    int rc;
+
+    if (proto != PROTO_FRAMED)
+    {
+        client_send_lock(client_fd);
+        rc = send_all(client_fd, buffer, length);
+        client_send_unlock(client_fd);
+        return rc;
+    }
+
+    encode_output_header(task_id, length, encoded);
+
+    iov[0].iov_base = encoded;
+    iov[0].iov_len = sizeof(encoded);
+    iov[1].iov_base = (void *)buffer;
+    iov[1].iov_len = length;
+
+    client_send_lock(client_fd);
+    rc = send_allv(client_fd, iov, 2);
+    client_send_unlock(client_fd);
+
+    return rc;
+}
+
+int send_client_end(int client_fd, int proto, int task_id, int status)
+{
+    FrameHeader header;
+    unsigned char encoded[FRAME_HEADER_SIZE];
+    int rc;
+
+    if (proto != PROTO_FRAMED)
+    {
+        client_send_lock(client_fd);
+        rc = send_end_marker(client_fd) < 0 ? -1 : 0;
+        client_send_unlock(client_fd);
+        return rc;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.version = PROTO_VERSION;
+    header.type = FRAME_END;
+    header.task_id = (uint32_t)task_id;
+    header.status = status;
+    frame_encode(&header, encoded);
+
+    client_send_lock(client_fd);
+    rc = send_all(client_fd, (const char *)encoded, sizeof(encoded));
+    client_send_unlock(client_fd);
+
+    return rc;
+}
+
 /* ---------- client id ---------- */
 static int allocate_client_id(void)
 {
@@ -123,6 +361,134 @@ static int parse_port_or_exit(const char *text)
     return (int)port;
 }
 
+/* ---------- parse worker count ---------- */
+static int parse_workers_or_exit(const char *text)
+{
+    char *endptr = NULL;
+    long workers = strtol(text, &endptr, 10);
+
+    if (text == NULL || *text == '\0' || *endptr != '\0' ||
+        workers < 1 || workers > MAX_WORKERS)
+    {
+        fprintf(stderr, "Invalid worker count (1-%d)\n", MAX_WORKERS);
+        exit(1);
+    }
+
+    return (int)workers;
+}
+
+/* ---------- parse default timeout ---------- */
+//-t: seconds a task may take from submission to completion, 0 for no limit
+static int parse_timeout_or_exit(const char *text)
+{
+    char *endptr = NULL;
+    long seconds = strtol(text, &endptr, 10);
+
+    if (text == NULL || *text == '\0' || *endptr != '\0' ||
+        seconds < 0 || seconds > INT_MAX / 1000)
+    {
+        fprintf(stderr, "Invalid timeout (seconds, 0 for none)\n");
+        exit(1);
+    }
+
+    return (int)seconds;
+}
+
+/* ---------- parse aging rate ---------- */
+//-a: ms of remaining time a waiting task is forgiven per second since its
+//submission, 0 for pure SJRF
+static int parse_aging_or_exit(const char *text)
+{
+    char *endptr = NULL;
+    long ms_per_s = strtol(text, &endptr, 10);
+
+    if (text == NULL || *text == '\0' || *endptr != '\0' ||
+        ms_per_s < 0 || ms_per_s > 1000000)
+    {
+        fprintf(stderr, "Invalid aging rate (ms per s, 0 for none)\n");
+        exit(1);
+    }
+
+    return (int)ms_per_s;
+}
+
+//mapping -q to a quantum mode: 1 for adaptive, 0 for fixed; exits with an
+//error on anything else
+static int parse_quantum_mode_or_exit(const char *text)
+{
+    if (strcmp(text, "fixed") == 0)
+    {
+        return 0;
+    }
+
+    if (strcmp(text, "adaptive") == 0)
+    {
+        return 1;
+    }
+
+    fprintf(stderr, "Invalid quantum mode (fixed|adaptive)\n");
+    exit(1);
+}
+
+//-Q first_ms,later_ms: the fixed quanta (and where adaptive ones start)
+static void parse_quanta_or_exit(const char *text, int *first_ms, int *later_ms)
+{
+    char *endptr = NULL;
+    long first = strtol(text, &endptr, 10);
+    long later;
+
+    if (endptr == text || *endptr != ',')
+    {
+        fprintf(stderr, "Invalid quanta (first_ms,later_ms)\n");
+        exit(1);
+    }
+
+    text = endptr + 1;
+    later = strtol(text, &endptr, 10);
+
+    if (*text == '\0' || *endptr != '\0' ||
+        first < 1 || first > INT_MAX / 10 || later < 1 || later > INT_MAX / 10)
+    {
+        fprintf(stderr, "Invalid quanta (first_ms,later_ms)\n");
+        exit(1);
+    }
+
+    *first_ms = (int)first;
+    *later_ms = (int)later;
+}
+
+//mapping -T to the trace unit: 1 for ms, 0 for seconds; exits with an
+//error on anything else
+static int parse_trace_unit_or_exit(const char *text)
+{
+    if (strcmp(text, "s") == 0)
+    {
+        return 0;
+    }
+
+    if (strcmp(text, "ms") == 0)
+    {
+        return 1;
+    }
+
+    fprintf(stderr, "Invalid trace unit (s|ms)\n");
+    exit(1);
+}
+
+//mapping -p to a scheduling policy; exits with an error on unknown names
+static const SchedPolicyOps *parse_policy_or_exit(const char *text)
+{
+    const SchedPolicyOps *policy = sched_policy_find(text);
+
+    if (policy == NULL)
+    {
+        fprintf(stderr, "Invalid policy (%s)\n", sched_policy_names());
+        exit(1);
+    }
+
+    return policy;
+}
+
 /* ---------- fallback bind ---------- */
 static int bind_with_fallback(
     int server_fd,
@@ -169,235 +535,616 @@ static void write_port_hint_file(int port)
     fclose(fp);
 }
 
-/* ---------- scheduler thread ---------- */
-static void *scheduler_thread(void *arg)
+/* ---------- scheduler threads ---------- */
+//returning an unfinished task to its worker's run queue; one that cannot be
+//stored again is ended with an error rather than lost silently
+static void requeue_task(Task *task)
 {
-    (void)arg;
+    const char *msg = "Error: could not requeue task\n";
 
-    scheduler_init();
+    if (enqueue_task_requeue(task) == 0)
+    {
+        return;
+    }
 
-    SchedulerState *sched = scheduler_get_state();
+    task->exit_status = 1;
+    send_client_output(task->client_fd, task->proto, task->task_id, msg, strlen(msg));
+
+    if (!dag_task_end(task))
+    {
+        send_client_end(task->client_fd, task->proto, task->task_id, 1);
+    }
+
+    free_task(task);
+}
+
+//putting a task that left the CPU unfinished back on its run queue, unless
+//it was cancelled meanwhile: then it is ended instead (still the worker's
+//current task, so a disconnecting client waits for it)
+static void requeue_unless_cancelled(int worker, Task *task)
+{
+    int cancel;
+
+    scheduler_lock_dispatch(worker);
+
+    cancel = scheduler_check_cancel(worker);
+
+    if (!cancel)
+    {
+        requeue_task(task);
+    }
+
+    scheduler_unlock_dispatch(worker);
 
-    //tracks how many completions have already been summarised so the
-    //summary prints exactly once each time the queue drains
-    int last_printed_total = 0;
+    if (cancel)
+    {
+        scheduler_end_cancelled(task, scheduler_check_cancel(worker));
+    }
+}
+
+//finishing a task's response, unless its client is gone (its socket may
+//be closed as soon as the task stops being current)
+static void end_response(int worker, Task *task)
+{
+    //a DAG node reports to its DAG, which ends the response once all are done
+    if (dag_task_end(task))
+    {
+        return;
+    }
+
+    if (scheduler_check_cancel(worker) == CANCEL_CLIENT_GONE)
+    {
+        return;
+    }
+
+    send_client_end(task->client_fd, task->proto, task->task_id, task->exit_status);
+    log_printf_locked("[%d]<<< %d bytes sent\n", task->client_id, task->bytes_sent);
+}
+
+//one executor worker: runs its own run queue under the active scheduling
+//policy and steals from peers when that queue is empty; arg carries the
+//worker index
+static void *scheduler_thread(void *arg)
+{
+    int worker = (int)(intptr_t)arg;
+
+    SchedulerState *sched = scheduler_get_state();
+    SchedulerWorker *self = scheduler_get_worker(worker);
 
     while (1)
     {
-        //selecting next task based on SJRF priority
-        Task *task = peek_best_task_sjrf(sched->last_selected_task_id);
+        Task *task;
+        Task *rejected = NULL;
+
+        //selecting next task by the active policy and removing it from the
+        //run queue under the same lock; it becomes current before a
+        //cancellation can look for it again
+        scheduler_lock_dispatch(worker);
+
+        task = pop_next_task(worker, self->last_selected_task_id, &rejected);
+
+        if (task == NULL)
+        {
+            task = steal_task(worker);
+        }
+
+        if (task != NULL)
+        {
+            scheduler_set_current_task(worker, task);
+        }
+
+        scheduler_unlock_dispatch(worker);
+
+        //replying to rejects may block on a client: never under the
+        //dispatch lock, which every cancellation takes
+        queue_reject_tasks(rejected);
 
         if (task == NULL)
         {
-            //queue is empty: only print summary when demo tasks ran (trace
+            //pool is idle: only print summary when demo tasks ran (trace
             //is non-empty); shell-only scenarios produce no trace so no
             //summary is shown, matching the expected sample output
-            if (sched->total_completed > last_printed_total)
+            if (queue_pool_idle() && scheduler_claim_summary())
             {
                 const char *trace = scheduler_get_trace();
                 if (trace && trace[0] != '\0')
                 {
                     log_printf_locked("[0] %s\n", trace);
                 }
-                last_printed_total = sched->total_completed;
+
+                if (g_log_stats)
+                {
+                    queue_log_stats();
+                    scheduler_print_summary();
+                }
+
+                //persisting what the finished shell commands taught
+                burst_predictor_save(BURST_HISTORY_FILE);
             }
-            usleep(100000);
+            //sleeping until enqueue/requeue/preemption wakes this worker
+            scheduler_wait(worker, -1);
             continue;
         }
 
-        //removing selected task from queue before executing
-        if (!dequeue_task_by_id(task->task_id))
-        {
-            //task was already removed (rare race, skip gracefully)
-            continue;
-        }
+        //what is left waiting here feeds the adaptive quanta
+        quantum_note_dispatch(queue_length(worker));
+
+        queue_set_busy(worker, 1);
+        scheduler_clear_preempt(worker);
 
-        scheduler_set_current_task(task);
-        scheduler_clear_preempt();
+        //per-client queue wait (unsigned ms arithmetic survives wrap-around)
+        fair_record_wait(task->client_id, (unsigned int)timer_now_ms() - task->queued_ms);
 
         //first scheduling logs "started"; subsequent schedulings log "running"
-        //shell tasks always log "started" (they complete in a single round)
         if (task->round_count == 0)
             scheduler_log_decision("started", task);
         else
             scheduler_log_decision("running", task);
 
-        //shell commands run to completion in one go with highest priority
+        //shell commands get quanta like demos: the process group is stopped
+        //when the quantum runs out or a better task arrives and continued
+        //when the task is picked again; shells stay out of the trace
         if (task->type == TASK_SHELL)
         {
-            int completed = scheduler_execute_task(task);
+            const SchedPolicyOps *policy = queue_policy();
+            int events;
+            uint64_t served_ns;
 
-            if (completed)
-{
-    send_end_marker(task->client_fd);
-log_printf_locked("[%d]<<< %d bytes sent\n", task->client_id, task->bytes_sent);
-scheduler_log_decision("ended", task);
+            scheduler_begin_quantum(worker, task, policy->quantum_for(task));
+            events = scheduler_run_child(worker, task);
+            served_ns = scheduler_end_quantum(worker, task);
 
-    sched->total_completed++;
-    sched->last_selected_task_id = -1;
-    free(task);
-}
-            scheduler_clear_current_task();
+            task->served_ns += served_ns;
+            fair_charge(task->client_id, served_ns);
+            task->round_count++;
+
+            if (events & SLICE_EXITED)
+            {
+                //the measured runtime orders the next submissions of it (a
+                //run killed at its deadline or cancelled was cut short and
+                //teaches nothing)
+                if (!(events & (SLICE_DEADLINE | SLICE_CANCELLED)))
+                {
+                    burst_predictor_record(task->command, task->served_ns / 1000000u);
+                    quantum_note_completion(task->served_ns / 1000000u);
+                }
+
+                fair_charge_cpu(task->client_id,
+                                self->exit_usage.user_us + self->exit_usage.system_us);
+
+                //the client's think time runs from here (stamped before the reply,
+                //which its next command may follow at once)
+                fair_note_end(task->client_id);
+                end_response(worker, task);
+                scheduler_log_decision("ended", task);
+
+                scheduler_record_completion(worker, task);
+                free_task(task);
+            }
+            else
+            {
+                policy->on_slice_end(task, events & SLICE_PREEMPTED ? SLICE_PREEMPTED : SLICE_QUANTUM);
+                scheduler_log_decision(events & SLICE_PREEMPTED ? "preempted" : "waiting", task);
+                self->last_selected_task_id = task->task_id;
+                requeue_unless_cancelled(worker, task);
+            }
+
+            scheduler_clear_current_task(worker);
+            scheduler_clear_preempt(worker);
+            queue_set_busy(worker, 0);
             continue;
         }
 
-        //demo tasks: per-task quantum — 3 seconds on first scheduling,
-        //7 seconds on every subsequent scheduling (per-task, not global)
-        int quantum = (task->round_count == 0) ? 3 : 7;
+        //demo tasks: the policy sets the quantum in ms (SJRF: the first-run
+        //quantum, 3 s unless configured or adapted, then the later one, 7 s)
+        //and later judges how it was used
+        const SchedPolicyOps *policy = queue_policy();
+        int quantum = policy->quantum_for(task);
         int task_completed = 0;
         int preempted_flag = 0;
-        int time_before_run = sched->total_time_used;
+        int time_used = 0;
+
+        scheduler_begin_quantum(worker, task, quantum);
 
-        for (int q = 0; q < quantum; q++)
+        while (1)
         {
-            //run one 1-second slice; returns 1 when task is fully done
-            int slice_done = scheduler_execute_task(task);
+            //running the demo program until the slice or quantum boundary,
+            //its exit, or the moment a better task arrives
+            int events = scheduler_run_child(worker, task);
 
             //update remaining time and cumulative global time in state
-            scheduler_update_task_after_execution(task, 1);
+            if (events & SLICE_EXPIRED)
+            {
+                time_used++;
+                scheduler_update_task_after_execution(task, 1);
+            }
 
-            if (slice_done)
+            //the program's exit ends the task, whatever is left of the
+            //measured time
+            if (events & SLICE_EXITED)
             {
-                task_completed = 1;
+                //a task killed at its deadline or cancelled keeps what it
+                //had left
+                if (!(events & (SLICE_DEADLINE | SLICE_CANCELLED)))
+                {
+                    task->remaining_time = 0;
+                }
+
+                task_completed = events & SLICE_CANCELLED ? 2 : 1;
                 break;
             }
 
-            //check if a higher-priority task arrived and set the preempt flag
-            if (scheduler_check_preempt())
+            //the last slice just ended: let the program print its final line
+            //and exit rather than requeue a task with nothing left to run.
+            //It stays stoppable: a program still burning CPU it was not
+            //given (slices are wall-clock time) is requeued after the grace
+            //slice instead of holding the worker until it exits
+            if (task->remaining_time == 0 && (events & SLICE_EXPIRED))
+            {
+                scheduler_grant_grace(worker);
+                continue;
+            }
+
+            if (events & SLICE_PREEMPTED)
             {
                 preempted_flag = 1;
                 break;
             }
+
+            if (events & SLICE_QUANTUM)
+            {
+                break;
+            }
         }
 
+        //the client's virtual runtime grows by the service just received
+        uint64_t served_ns = scheduler_end_quantum(worker, task);
+
+        task->served_ns += served_ns;
+        fair_charge(task->client_id, served_ns);
+
         //record one trace entry per quantum run using the cumulative CPU time
-        //and the client id (shown as "P<client_id>-(<total_time>)" in output)
-        if (sched->total_time_used > time_before_run)
-{
-    scheduler_append_trace(task->client_id, sched->total_time_used);
-}
+        //of the whole pool and the client id (shown as
+        //"P<client_id>-(<total_time>)" in output): whole slices, or with -T ms
+        //the ms of demo service, partial slices included
+        if (g_trace_ms && served_ns > 0)
+        {
+            scheduler_append_trace(task->client_id, (int)(sched->total_service_ns / 1000000u));
+        }
+        else if (!g_trace_ms && time_used > 0)
+        {
+            scheduler_append_trace(task->client_id, sched->total_time_used);
+        }
         //advance this task's personal round counter after each quantum run
-        //so the next scheduling correctly picks the 7-second quantum
+        //so the next scheduling correctly picks the later-run quantum
         task->round_count++;
 
+        if (!task_completed)
+        {
+            policy->on_slice_end(task, preempted_flag ? SLICE_PREEMPTED : SLICE_QUANTUM);
+        }
+
         if (task_completed)
-{
-   send_end_marker(task->client_fd);
-log_printf_locked("[%d]<<< %d bytes sent\n", task->client_id, task->bytes_sent);
-scheduler_log_decision("ended", task);
-    sched->total_completed++;
-    sched->last_selected_task_id = -1;
-    free(task);
-}
+        {
+            //the client pays for the CPU its program actually burned
+            fair_charge_cpu(task->client_id,
+                            self->exit_usage.user_us + self->exit_usage.system_us);
+
+            if (task_completed == 1)
+            {
+                quantum_note_completion(task->served_ns / 1000000u);
+            }
+
+            //the client's think time runs from here
+            fair_note_end(task->client_id);
+            end_response(worker, task);
+            scheduler_log_decision("ended", task);
+            scheduler_record_completion(worker, task);
+            free_task(task);
+        }
         else if (preempted_flag)
         {
             //preempted by a shorter incoming task — log distinctly from
             //"waiting" (quantum expiry) so the server log matches spec output
             scheduler_log_decision("preempted", task);
-            sched->last_selected_task_id = task->task_id;
-            enqueue_task_requeue(task);
+            self->last_selected_task_id = task->task_id;
+            requeue_unless_cancelled(worker, task);
         }
         else
         {
             //quantum expired — task goes back to the queue for the next round
             scheduler_log_decision("waiting", task);
-            sched->last_selected_task_id = task->task_id;
-            enqueue_task_requeue(task);
+            self->last_selected_task_id = task->task_id;
+            requeue_unless_cancelled(worker, task);
         }
 
-        scheduler_clear_current_task();
-        scheduler_clear_preempt();
+        scheduler_clear_current_task(worker);
+        scheduler_clear_preempt(worker);
+        queue_set_busy(worker, 0);
     }
 
     return NULL;
 }
 
 /* ---------- client session ---------- */
-static void handle_client_session(ClientContext *ctx)
+//"policy" reports the active scheduling policy, "policy <name>" switches
+//the whole pool to another one (queued tasks are re-filed at once)
+static int session_handle_policy(ClientContext *ctx, const char *arg)
 {
-    while (1)
+    const SchedPolicyOps *policy;
+    char reply[128];
+    int len;
+
+    while (*arg == ' ')
     {
-        char buffer[BUFFER_SIZE];
-        ssize_t bytes_received;
-        Task *task;
+        arg++;
+    }
 
-        memset(buffer, 0, sizeof(buffer));
+    policy = *arg == '\0' ? queue_policy() : sched_policy_find(arg);
 
-        bytes_received = recv(ctx->client_fd, buffer, BUFFER_SIZE - 1, 0);
+    if (policy == NULL)
+    {
+        len = snprintf(reply, sizeof(reply), "Unknown policy (%s)\n", sched_policy_names());
+        send_client_output(ctx->client_fd, ctx->proto, 0, reply, (size_t)len);
+        send_client_end(ctx->client_fd, ctx->proto, 0, 1);
+        return 0;
+    }
 
-        if (bytes_received < 0)
-        {
-            perror("recv");
-            break;
-        }
+    if (*arg != '\0' && policy != queue_policy())
+    {
+        queue_switch_policy(policy);
 
-        if (bytes_received == 0)
-        {
-            break;
-        }
+        log_printf_locked(
+            "[INFO] Client #%d switched scheduling policy to %s.\n",
+            ctx->client_id,
+            policy->name);
+    }
 
-        buffer[bytes_received] = '\0';
-        buffer[strcspn(buffer, "\n")] = '\0';
+    len = snprintf(reply, sizeof(reply), "Scheduling policy: %s\n", policy->name);
+    send_client_output(ctx->client_fd, ctx->proto, 0, reply, (size_t)len);
+    send_client_end(ctx->client_fd, ctx->proto, 0, 0);
 
-        log_printf_locked("[%d]>>> %s\n", ctx->client_id, buffer);
+    return 0;
+}
 
-        if (strlen(buffer) == 0)
-        {
-            send_end_marker(ctx->client_fd);
-            continue;
-        }
+//sending a cancel command's reply (msg may be null) and its end while a
+//worker may still be forwarding the cancelled tasks' output: both go out
+//under the client's send lock, never inside a frame a worker announced
+static void send_cancel_reply(ClientContext *ctx, const char *msg, int status)
+{
+    client_send_lock(ctx->client_fd);
 
-        if (strcmp(buffer, "exit") == 0)
-        {
-            log_printf_locked(
-                "[INFO] [Client #%d - %s:%d] Client requested disconnect.\n",
-                ctx->client_id,
-                ctx->client_ip,
-                ctx->client_port);
-            break;
-        }
+    if (msg != NULL)
+    {
+        send_client_output(ctx->client_fd, ctx->proto, 0, msg, strlen(msg));
+    }
 
-        task = create_task_from_command(ctx, buffer);
+    send_client_end(ctx->client_fd, ctx->proto, 0, status);
 
-        if (task == NULL)
+    client_send_unlock(ctx->client_fd);
+}
+
+//"cancel" stops every task of this client, "cancel <task_id>" one of them
+//(a framed client sees task ids in its frames): each ends its own response
+//with TASK_CANCELLED_STATUS, this command's reply is empty unless nothing
+//was found
+static int session_handle_cancel(ClientContext *ctx, const char *arg)
+{
+    char *end = NULL;
+    long task_id = 0;
+    int count;
+
+    while (*arg == ' ')
+    {
+        arg++;
+    }
+
+    if (*arg != '\0')
+    {
+        task_id = strtol(arg, &end, 10);
+
+        if (end == arg || *end != '\0' || task_id < 1 || task_id > INT_MAX)
         {
-            const char *msg = "Error: could not create task\n";
-            send_all(ctx->client_fd, msg, strlen(msg));
-            send_end_marker(ctx->client_fd);
-            continue;
+            send_cancel_reply(ctx, "Usage: cancel [task_id]\n", 1);
+            return 0;
         }
+    }
 
-        enqueue_task(task);
+    count = scheduler_cancel_tasks(ctx->client_id, (int)task_id, CANCEL_REQUESTED);
+
+    if (count == 0)
+    {
+        send_cancel_reply(ctx, "No such task\n", 1);
+        return 0;
+    }
+
+    log_printf_locked(
+        "[INFO] Client #%d cancelled %d task(s).\n",
+        ctx->client_id,
+        count);
+
+    send_cancel_reply(ctx, NULL, 0);
+
+    return 0;
+}
+
+ClientContext *session_open(int client_fd, const struct sockaddr_in *address)
+{
+    ClientContext *ctx = (ClientContext *)malloc(sizeof(ClientContext));
+
+    if (ctx == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (send_lock_prepare(client_fd) < 0)
+    {
+        log_printf_locked("[INFO] Dropping connection on descriptor %d (no send lock).\n", client_fd);
+        free(ctx);
+        return NULL;
+    }
+
+    ctx->client_fd = client_fd;
+    ctx->client_id = allocate_client_id();
+    fair_client_open(ctx->client_id);
+    ctx->thread_index = ctx->client_id;
+    ctx->client_port = ntohs(address->sin_port);
+
+    if (inet_ntop(AF_INET,
+                  &address->sin_addr,
+                  ctx->client_ip,
+                  sizeof(ctx->client_ip)) == NULL)
+    {
+        strncpy(ctx->client_ip, "unknown", sizeof(ctx->client_ip) - 1);
+        ctx->client_ip[sizeof(ctx->client_ip) - 1] = '\0';
+    }
+
+    log_printf_locked(
+        "[%d]<<< client connected\n",
+        ctx->client_id);
+
+    return ctx;
+}
+
+int session_handle_line(ClientContext *ctx, char *line)
+{
+    //negotiation request: answer with a hello frame and switch to frames
+    if (ctx->proto == PROTO_TEXT && strcmp(line, PROTO_HELLO) == 0)
+    {
+        FrameHeader header;
+        unsigned char encoded[FRAME_HEADER_SIZE];
+        int rc;
+
+        memset(&header, 0, sizeof(header));
+        header.version = PROTO_VERSION;
+        header.type = FRAME_HELLO;
+        frame_encode(&header, encoded);
+
+        ctx->proto = PROTO_FRAMED;
 
         log_printf_locked(
-            "(%d)--- created (%d)\n",
+            "[INFO] Client #%d negotiated framed protocol v%d.\n",
             ctx->client_id,
-            task->burst_time);
+            PROTO_VERSION);
+
+        client_send_lock(ctx->client_fd);
+        rc = send_all(ctx->client_fd, (const char *)encoded, sizeof(encoded));
+        client_send_unlock(ctx->client_fd);
+
+        return rc < 0 ? -1 : 0;
     }
+
+    return session_handle_command(ctx, line);
 }
 
-/* ---------- client worker ---------- */
-static void *client_worker_thread(void *arg)
+int session_handle_command(ClientContext *ctx, char *command)
 {
-    ClientContext *ctx = (ClientContext *)arg;
+    Task *task;
 
-    handle_client_session(ctx);
+    log_printf_locked("[%d]>>> %s\n", ctx->client_id, command);
 
-    remove_tasks_for_client(ctx->client_id);
+    if (strlen(command) == 0)
+    {
+        send_client_end(ctx->client_fd, ctx->proto, 0, 0);
+        return 0;
+    }
 
-    close(ctx->client_fd);
+    if (strcmp(command, "exit") == 0)
+    {
+        log_printf_locked(
+            "[INFO] [Client #%d - %s:%d] Client requested disconnect.\n",
+            ctx->client_id,
+            ctx->client_ip,
+            ctx->client_port);
+        return -1;
+    }
 
-    log_printf_locked("[INFO] Client #%d disconnected.\n\n", ctx->client_id);
+    if (strncmp(command, "policy", 6) == 0 && (command[6] == '\0' || command[6] == ' '))
+    {
+        return session_handle_policy(ctx, command + 6);
+    }
 
-    free(ctx);
+    if (strncmp(command, "dag", 3) == 0 && (command[3] == '\0' || command[3] == ' '))
+    {
+        return dag_submit(ctx, command + 3);
+    }
 
-    return NULL;
+    if (strncmp(command, "cancel", 6) == 0 && (command[6] == '\0' || command[6] == ' '))
+    {
+        return session_handle_cancel(ctx, command + 6);
+    }
+
+    task = create_task_from_command(ctx, command);
+
+    if (task == NULL)
+    {
+        const char *msg = "Error: could not create task\n";
+        send_client_output(ctx->client_fd, ctx->proto, 0, msg, strlen(msg));
+        send_client_end(ctx->client_fd, ctx->proto, 0, 1);
+        return 0;
+    }
+
+    //a command typed in an active session runs ahead of batch work for a
+    //while (tasks a DAG launches are not typed and never count here)
+    if (fair_note_submit(ctx->client_id))
+    {
+        task->boost_ms = INTERACTIVE_BOOST_MS;
+    }
+
+    //logging before the enqueue: a woken worker may start (and free) the
+    //task straight away
+    log_printf_locked(
+        "(%d)--- created (%d)\n",
+        ctx->client_id,
+        task->burst_time);
+
+    quantum_note_arrival();
+
+    if (enqueue_task(task) < 0)
+    {
+        const char *msg = "Error: could not queue task\n";
+        send_client_output(ctx->client_fd, ctx->proto, task->task_id, msg, strlen(msg));
+        send_client_end(ctx->client_fd, ctx->proto, task->task_id, 1);
+        free_task(task);
+    }
+
+    return 0;
+}
+
+//releasing a disconnected client once no worker runs its tasks any more:
+//only then may its descriptor be closed (and reused)
+static void session_release(int client_id, int client_fd)
+{
+    fair_client_close(client_id, g_log_stats);
+
+    close(client_fd);
+
+    log_printf_locked("[INFO] Client #%d disconnected.\n\n", client_id);
+}
+
+void session_close(ClientContext *ctx)
+{
+    //sends still in flight to this client fail at once; its queued tasks
+    //are dropped and running ones flagged, and the worker whose task stops
+    //last closes the socket, so this I/O thread never waits for them
+    shutdown(ctx->client_fd, SHUT_RDWR);
+    dag_client_gone(ctx->client_id);
+    scheduler_cancel_tasks(ctx->client_id, 0, CANCEL_CLIENT_GONE);
+    scheduler_release_client(ctx->client_id, ctx->client_fd, session_release);
+
+    free(ctx->recv_buf);
+    free(ctx);
 }
 
 /* ---------- main ---------- */
 int main(int argc, char **argv)
 {
     signal(SIGINT, handle_sigint);
+    //a vanished client must not kill the server from inside send/splice
+    signal(SIGPIPE, SIG_IGN);
     int server_fd;
     int port = PORT;
     int bound_port = PORT;
@@ -405,20 +1152,60 @@ int main(int argc, char **argv)
     int option = 1;
     struct sockaddr_in address;
     pthread_t sched_tid;
+    const char *net_backend;
+    int workers = DEFAULT_WORKERS;
+    const SchedPolicyOps *policy = &sched_policy_sjrf;
+    int timeout_s = 0;
+    int adaptive_quanta = 0;
+    int aging_ms_per_s = 0;
+    int first_quantum_ms = QUANTUM_DEFAULT_FIRST_MS;
+    int later_quantum_ms = QUANTUM_DEFAULT_LATER_MS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:p:t:q:a:Q:T:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w':
+            workers = parse_workers_or_exit(optarg);
+            break;
+        case 'p':
+            policy = parse_policy_or_exit(optarg);
+            break;
+        case 't':
+            timeout_s = parse_timeout_or_exit(optarg);
+            break;
+        case 'q':
+            adaptive_quanta = parse_quantum_mode_or_exit(optarg);
+            break;
+        case 'a':
+            aging_ms_per_s = parse_aging_or_exit(optarg);
+            break;
+        case 'Q':
+            parse_quanta_or_exit(optarg, &first_quantum_ms, &later_quantum_ms);
+            break;
+        case 'T':
+            g_trace_ms = parse_trace_unit_or_exit(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w workers] [-p %s] [-t timeout_s] [-q fixed|adaptive] [-a aging_ms_per_s] [-Q first_ms,later_ms] [-T s|ms] [port]\n", argv[0], sched_policy_names());
+            return 1;
+        }
+    }
 
-    if (argc > 2)
+    if (argc - optind > 1)
     {
-        fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-w workers] [-p %s] [-t timeout_s] [-q fixed|adaptive] [-a aging_ms_per_s] [-Q first_ms,later_ms] [-T s|ms] [port]\n", argv[0], sched_policy_names());
         return 1;
     }
 
-    if (argc == 2)
+    if (argc - optind == 1)
     {
-        port = parse_port_or_exit(argv[1]);
+        port = parse_port_or_exit(argv[optind]);
         max_tries = 1;
     }
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
 
     if (server_fd < 0)
     {
@@ -474,7 +1261,7 @@ int main(int argc, char **argv)
 
     write_port_hint_file(bound_port);
 
-    if (listen(server_fd, 5) < 0)
+    if (listen(server_fd, SOMAXCONN) < 0)
     {
         perror("listen");
         close(server_fd);
@@ -482,82 +1269,68 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    if (pthread_create(&sched_tid, NULL, scheduler_thread, NULL) != 0)
+    g_log_stats = getenv("MYSHELL_STATS") != NULL;
+
+    //before any worker thread exists: the signalfd fallback blocks SIGCHLD
+    //in every thread
+    if (child_manager_init() < 0)
     {
-        perror("pthread_create scheduler");
         close(server_fd);
         close(g_server_log_fd);
         return 1;
     }
 
-    pthread_detach(sched_tid);
-
-    log_printf_locked("------------------------------\n| Hello, Server Started |\n------------------------------\n\n");
-
-    while (1)
+    if (strcmp(child_manager_backend(), "pidfd") != 0)
     {
-        int client_fd;
-        int client_id;
-        struct sockaddr_in client_address;
-        socklen_t client_address_length = sizeof(client_address);
-        ClientContext *ctx;
-        pthread_t worker_tid;
+        log_printf_locked("[INFO] pidfd unavailable, reaping children through a SIGCHLD signalfd.\n");
+    }
 
-        client_fd = accept(server_fd,
-                           (struct sockaddr *)&client_address,
-                           &client_address_length);
+    if (burst_predictor_load(BURST_HISTORY_FILE) < 0)
+    {
+        log_printf_locked("[INFO] Ignoring unreadable %s.\n", BURST_HISTORY_FILE);
+    }
 
-        if (client_fd < 0)
-        {
-            perror("accept");
-            continue;
-        }
+    queue_set_default_timeout(timeout_s * 1000);
+    quantum_init(adaptive_quanta, workers, first_quantum_ms, later_quantum_ms);
+    sched_policy_set_aging(aging_ms_per_s);
+    queue_set_policy(policy);
+    queue_init(workers);
 
-        ctx = (ClientContext *)malloc(sizeof(ClientContext));
+    if (scheduler_init(queue_worker_count()) < 0)
+    {
+        close(server_fd);
+        close(g_server_log_fd);
+        return 1;
+    }
 
-        if (ctx == NULL)
+    for (int i = 0; i < queue_worker_count(); i++)
+    {
+        if (pthread_create(&sched_tid, NULL, scheduler_thread, (void *)(intptr_t)i) != 0)
         {
-            perror("malloc");
-            close(client_fd);
-            continue;
+            perror("pthread_create scheduler");
+            close(server_fd);
+            close(g_server_log_fd);
+            return 1;
         }
 
-        client_id = allocate_client_id();
-
-        memset(ctx, 0, sizeof(*ctx));
-
-        ctx->client_fd = client_fd;
-        ctx->client_id = client_id;
-        ctx->thread_index = client_id;
-        ctx->client_port = ntohs(client_address.sin_port);
-
-        if (inet_ntop(AF_INET,
-                      &client_address.sin_addr,
-                      ctx->client_ip,
-                      sizeof(ctx->client_ip)) == NULL)
-        {
-            strncpy(ctx->client_ip, "unknown", sizeof(ctx->client_ip) - 1);
-            ctx->client_ip[sizeof(ctx->client_ip) - 1] = '\0';
-        }
+        pthread_detach(sched_tid);
+    }
 
-        log_printf_locked(
-            "[%d]<<< client connected\n",
-            ctx->client_id);
+    log_printf_locked("------------------------------\n| Hello, Server Started |\n------------------------------\n\n");
 
-        if (pthread_create(&worker_tid,
-                           NULL,
-                           client_worker_thread,
-                           ctx) != 0)
-        {
-            perror("pthread_create");
-            close(client_fd);
-            free(ctx);
-            continue;
-        }
+    //MYSHELL_NET=io_uring selects the io_uring backend when it was built
+    //in (make server IO_URING=1); otherwise, or when the kernel lacks the
+    //needed features, the epoll reactor owns accept/recv for every client
+    net_backend = getenv("MYSHELL_NET");
 
-        pthread_detach(worker_tid);
+    if (net_backend != NULL && strcmp(net_backend, "io_uring") == 0 &&
+        uring_run(server_fd) < 0)
+    {
+        log_printf_locked("[INFO] io_uring backend unavailable, using epoll.\n");
     }
 
+    reactor_run(server_fd, REACTOR_IO_THREADS);
+
     close(server_fd);
     close(g_server_log_fd);
 
@@ -3,9 +3,11 @@
 
 #include <stddef.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
+
+#include "protocol.h"
 
 #define BUFFER_SIZE 4096
-#define END_MARKER "<<END>>"
 
 typedef struct
 {
@@ -14,10 +16,72 @@ typedef struct
     int client_port;
     char client_ip[INET_ADDRSTRLEN];
     int thread_index;
+
+    //negotiated protocol (PROTO_TEXT until the client sends PROTO_HELLO)
+    int proto;
+
+    //partial command line or frame being received (null while idle so an
+    //idle connection costs only this struct)
+    char *recv_buf;
+    size_t recv_len;
+    size_t recv_cap;
+
+    //set after an over-long line was truncated: drop bytes until newline
+    int discarding;
+
+    //io_uring backend: recv cancelled, free once its final completion lands
+    int closing;
 } ClientContext;
 
 void log_printf_locked(const char *fmt, ...);
 int send_all(int sockfd, const char *buffer, size_t length);
+
+//sending several buffers back to back; linked io_uring sends when that
+//backend is active, plain send() otherwise
+int send_allv(int sockfd, const struct iovec *iov, int iovcnt);
+
+//blocking-path gather send (waits for POLLOUT on a full socket)
+int send_allv_plain(int sockfd, const struct iovec *iov, int iovcnt);
+
+//holding a client's send lock (recursive) across everything that must reach
+//its socket back to back; send_client_output and send_client_end take it
+//for their own frame
+void client_send_lock(int client_fd);
+void client_send_unlock(int client_fd);
+
 int send_end_marker(int client_fd);
 
+//sending a chunk of task output in the client's protocol (raw bytes, or
+//one FRAME_OUTPUT frame tagged with task_id)
+int send_client_output(int client_fd, int proto, int task_id, const char *buffer, size_t length);
+
+//announcing a FRAME_OUTPUT payload of length bytes that the caller then
+//delivers itself (spliced straight from a pipe); the caller holds the
+//client's send lock until the payload is out
+int send_output_header(int client_fd, int task_id, size_t length);
+
+//finishing a response in the client's protocol (END_MARKER, or a FRAME_END
+//frame carrying the exit status)
+int send_client_end(int client_fd, int proto, int task_id, int status);
+
+//session hooks implemented by server.c and driven by the network backend
+
+//registering a freshly accepted (non-blocking) client socket
+//returns the new context or null when the connection must be dropped
+ClientContext *session_open(int client_fd, const struct sockaddr_in *address);
+
+//handling one complete text line (newline already stripped); the
+//negotiation line switches the connection to the framed protocol
+//returns 0 to keep the connection, -1 when it should be closed
+int session_handle_line(ClientContext *ctx, char *line);
+
+//handling one command, from a text line or a FRAME_COMMAND payload
+//returns 0 to keep the connection, -1 when it should be closed
+int session_handle_command(ClientContext *ctx, char *command);
+
+//cancelling the client's tasks (queued ones dropped, running ones killed)
+//and freeing the context; the socket is closed once no task of the client
+//runs any more, by the worker whose task stops last (never waited for here)
+void session_close(ClientContext *ctx);
+
 #endif
@@ -0,0 +1,186 @@
+#include "slab.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+//block sizes served from the slabs; a Task takes two cache lines of 128
+#define SLAB_CLASSES 16
+
+static const size_t slab_class_sizes[SLAB_CLASSES] =
+{
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, SLAB_MAX_SIZE
+};
+
+//chunk bytes reserved for the chunk header (one cache line)
+#define SLAB_CHUNK_HEADER 64
+
+//free block; the link lives in the block's own storage
+typedef struct SlabBlock
+{
+    struct SlabBlock *next;
+} SlabBlock;
+
+//one thread's free lists, per size class
+typedef struct SlabCache
+{
+    SlabBlock *local[SLAB_CLASSES];     //owner thread only
+    SlabBlock *remote[SLAB_CLASSES];    //pushed by other threads (atomic)
+} SlabCache;
+
+//start of every chunk: the thread whose cache its blocks return to
+typedef struct
+{
+    SlabCache *owner;
+} SlabChunk;
+
+static __thread SlabCache *tls_cache = NULL;
+
+static int slab_class_for(size_t size)
+{
+    for (int c = 0; c < SLAB_CLASSES; c++)
+    {
+        if (size <= slab_class_sizes[c])
+        {
+            return c;
+        }
+    }
+
+    return -1;
+}
+
+//caches live as long as the process: blocks of an exited thread may still
+//be freed remotely into them
+static SlabCache *slab_cache(void)
+{
+    if (tls_cache == NULL)
+    {
+        tls_cache = (SlabCache *)calloc(1, sizeof(SlabCache));
+    }
+
+    return tls_cache;
+}
+
+//cutting a fresh chunk into blocks of one class on the owner's local list
+static int slab_carve(SlabCache *cache, int size_class)
+{
+    size_t size = slab_class_sizes[size_class];
+    void *memory = NULL;
+    SlabChunk *chunk;
+
+    if (posix_memalign(&memory, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    chunk = (SlabChunk *)memory;
+    chunk->owner = cache;
+
+    //pushing from the end keeps the list in address order
+    for (size_t i = (SLAB_CHUNK_SIZE - SLAB_CHUNK_HEADER) / size; i > 0; i--)
+    {
+        SlabBlock *block = (SlabBlock *)((char *)memory + SLAB_CHUNK_HEADER + (i - 1) * size);
+
+        block->next = cache->local[size_class];
+        cache->local[size_class] = block;
+    }
+
+    return 0;
+}
+
+void *slab_alloc(size_t size)
+{
+    int size_class = slab_class_for(size);
+    SlabCache *cache;
+    SlabBlock *block;
+
+    if (size_class < 0)
+    {
+        return malloc(size);
+    }
+
+    cache = slab_cache();
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    if (cache->local[size_class] == NULL)
+    {
+        //adopting everything other threads returned since the last time
+        cache->local[size_class] =
+            __atomic_exchange_n(&cache->remote[size_class], NULL, __ATOMIC_ACQUIRE);
+    }
+
+    if (cache->local[size_class] == NULL && slab_carve(cache, size_class) < 0)
+    {
+        return NULL;
+    }
+
+    block = cache->local[size_class];
+    cache->local[size_class] = block->next;
+
+    return block;
+}
+
+void slab_free(void *ptr, size_t size)
+{
+    int size_class = slab_class_for(size);
+    SlabChunk *chunk;
+    SlabBlock *block = (SlabBlock *)ptr;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    if (size_class < 0)
+    {
+        free(ptr);
+        return;
+    }
+
+    chunk = (SlabChunk *)((uintptr_t)ptr & ~((uintptr_t)SLAB_CHUNK_SIZE - 1));
+
+    if (chunk->owner == tls_cache)
+    {
+        block->next = chunk->owner->local[size_class];
+        chunk->owner->local[size_class] = block;
+        return;
+    }
+
+    //lock-free push; only the owner ever takes the list (whole, by exchange)
+    //so there is no ABA window
+    block->next = __atomic_load_n(&chunk->owner->remote[size_class], __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&chunk->owner->remote[size_class],
+                                        &block->next,
+                                        block,
+                                        1,
+                                        __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+    {
+    }
+}
+
+char *slab_strdup(const char *text)
+{
+    size_t size = strlen(text) + 1;
+    char *copy = (char *)slab_alloc(size);
+
+    if (copy != NULL)
+    {
+        memcpy(copy, text, size);
+    }
+
+    return copy;
+}
+
+void slab_free_string(char *text)
+{
+    if (text != NULL)
+    {
+        slab_free(text, strlen(text) + 1);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+//size-classed slab allocator with per-thread caches: each thread carves
+//blocks out of its own 64 KiB chunks and reuses them without locking; a
+//block freed on another thread is pushed onto its owner's lock-free remote
+//list and adopted by the owner when its local list runs dry
+//frees are sized (the caller passes the size it allocated) so no per-block
+//header is needed; sizes above SLAB_MAX_SIZE go to malloc()
+
+//bytes per chunk; chunks are aligned to their size so a block finds its
+//chunk (and owning thread) by masking its address
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+//largest size served from the slabs
+#define SLAB_MAX_SIZE 4096
+
+//returns uninitialised storage for size bytes, or null when out of memory
+void *slab_alloc(size_t size);
+
+//returning a block obtained from slab_alloc(size) (null is ignored)
+void slab_free(void *ptr, size_t size);
+
+//duplicating a NUL-terminated string into slab storage
+//returns null when out of memory; release with slab_free_string
+char *slab_strdup(const char *text);
+
+//releasing a string from slab_strdup
+void slab_free_string(char *text);
+
+#endif
@@ -0,0 +1,73 @@
+#include "../timer_wheel.h"
+
+#include <stdio.h>
+
+//checks for timer_wheel_next_timeout; run with make test
+static int failures = 0;
+
+static void expect(int64_t got, int64_t want, const char *what)
+{
+    if (got != want)
+    {
+        fprintf(stderr, "FAIL %s: got %lld, want %lld\n", what, (long long)got, (long long)want);
+        failures++;
+    }
+}
+
+//a level 1 timer cascading before a level 0 one expires must bound the wait
+static void test_upper_level_first(void)
+{
+    //a base in the future and aligned to every level: the wheel is not
+    //caught up to the real clock, and the timers land on known levels
+    uint64_t base = (timer_now_ms() | 4095) + 1;
+    TimerWheel wheel;
+    TimerEntry first;
+    TimerEntry second;
+
+    timer_wheel_init(&wheel, base);
+    timer_entry_init(&first, 0, NULL);
+    timer_entry_init(&second, 1, NULL);
+
+    //1024 ms out: filed on level 1, cascading at base + 1024
+    timer_wheel_add(&wheel, &first, base + 1024);
+    expect(timer_wheel_advance(&wheel, base + 1000) == NULL, 1, "nothing expired by base + 1000");
+
+    //50 ms out from there: level 0
+    timer_wheel_add(&wheel, &second, base + 1050);
+    expect(timer_wheel_next_timeout(&wheel, base + 1000), 24, "level 1 timer ahead of level 0");
+
+    expect(timer_wheel_advance(&wheel, base + 1024) == &first, 1, "first timer expires at 1024");
+    expect(timer_wheel_next_timeout(&wheel, base + 1024), 26, "then the level 0 timer");
+}
+
+//only level 0 timers: the exact earliest expiry
+static void test_level_zero(void)
+{
+    uint64_t base = (timer_now_ms() | 4095) + 1;
+    TimerWheel wheel;
+    TimerEntry a;
+    TimerEntry b;
+
+    timer_wheel_init(&wheel, base);
+    timer_entry_init(&a, 0, NULL);
+    timer_entry_init(&b, 1, NULL);
+
+    expect(timer_wheel_next_timeout(&wheel, base), -1, "empty wheel");
+
+    timer_wheel_add(&wheel, &a, base + 40);
+    timer_wheel_add(&wheel, &b, base + 7);
+    expect(timer_wheel_next_timeout(&wheel, base), 7, "earliest of two level 0 timers");
+}
+
+int main(void)
+{
+    test_upper_level_first();
+    test_level_zero();
+
+    if (failures == 0)
+    {
+        printf("timer_wheel: all checks passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
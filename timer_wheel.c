@@ -0,0 +1,277 @@
+#include "timer_wheel.h"
+
+#include <string.h>
+#include <time.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+uint64_t timer_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t timer_now_ms(void)
+{
+    return timer_now_ns() / 1000000u;
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now_ms;
+}
+
+void timer_entry_init(TimerEntry *entry, int kind, void *owner)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->kind = kind;
+    entry->owner = owner;
+}
+
+//finding the slot for an expiry relative to the wheel's current tick
+static TimerEntry **wheel_slot_for(TimerWheel *wheel, uint64_t expires)
+{
+    uint64_t delta;
+    int level;
+
+    if (expires <= wheel->now)
+    {
+        expires = wheel->now + 1;
+    }
+
+    delta = expires - wheel->now;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++)
+    {
+        if (delta < ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1))))
+        {
+            break;
+        }
+    }
+
+    //timers beyond the top level's span wait in its farthest slot and are
+    //re-filed every time that slot cascades
+    if (level == TIMER_WHEEL_LEVELS - 1 &&
+        delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)))
+    {
+        expires = wheel->now + ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    }
+
+    return &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+}
+
+static void wheel_link(TimerEntry **slot, TimerEntry *entry)
+{
+    entry->pprev = slot;
+    entry->next = *slot;
+
+    if (*slot != NULL)
+    {
+        (*slot)->pprev = &entry->next;
+    }
+
+    *slot = entry;
+}
+
+static void wheel_insert(TimerWheel *wheel, TimerEntry *entry)
+{
+    wheel_link(wheel_slot_for(wheel, entry->expires), entry);
+}
+
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *entry, uint64_t expires_ms)
+{
+    timer_wheel_cancel(wheel, entry);
+
+    //an empty wheel is not advanced while its owner idles: catch up first,
+    //or the next advance would walk every idle millisecond one tick at a time
+    if (wheel->count == 0)
+    {
+        uint64_t now_ms = timer_now_ms();
+
+        if (now_ms > wheel->now)
+        {
+            wheel->now = now_ms;
+        }
+    }
+
+    entry->expires = expires_ms;
+    entry->pending = 1;
+    wheel->count++;
+
+    wheel_insert(wheel, entry);
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *entry)
+{
+    if (!entry->pending)
+    {
+        return;
+    }
+
+    *entry->pprev = entry->next;
+
+    if (entry->next != NULL)
+    {
+        entry->next->pprev = entry->pprev;
+    }
+
+    entry->next = NULL;
+    entry->pprev = NULL;
+    entry->pending = 0;
+    wheel->count--;
+}
+
+//moving every timer of an upper-level slot down to where it now belongs
+static void wheel_cascade(TimerWheel *wheel, int level, int index)
+{
+    TimerEntry *entry = wheel->slots[level][index];
+
+    wheel->slots[level][index] = NULL;
+
+    while (entry != NULL)
+    {
+        TimerEntry *next = entry->next;
+
+        //one due this very tick goes to the level 0 slot expired next
+        //(wheel_insert would push it to the tick after)
+        if (entry->expires <= wheel->now)
+        {
+            wheel_link(&wheel->slots[0][wheel->now & TIMER_WHEEL_MASK], entry);
+        }
+        else
+        {
+            wheel_insert(wheel, entry);
+        }
+
+        entry = next;
+    }
+}
+
+TimerEntry *timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms)
+{
+    TimerEntry *expired = NULL;
+
+    //nothing armed: jump straight to the new time
+    if (wheel->count == 0)
+    {
+        if (now_ms > wheel->now)
+        {
+            wheel->now = now_ms;
+        }
+
+        return NULL;
+    }
+
+    while (wheel->now < now_ms)
+    {
+        TimerEntry *entry;
+        int index;
+
+        wheel->now++;
+        index = (int)(wheel->now & TIMER_WHEEL_MASK);
+
+        //crossing a level-0 wrap pulls the next slot of each upper level down
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (((wheel->now >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) != 0)
+            {
+                break;
+            }
+
+            wheel_cascade(wheel, level,
+                          (int)((wheel->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK));
+        }
+
+        entry = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+
+        while (entry != NULL)
+        {
+            TimerEntry *next = entry->next;
+
+            if (entry->expires <= wheel->now)
+            {
+                entry->pending = 0;
+                entry->pprev = NULL;
+                entry->next = expired;
+                expired = entry;
+                wheel->count--;
+            }
+            else
+            {
+                //parked at the top-level horizon: file it again
+                wheel_insert(wheel, entry);
+            }
+
+            entry = next;
+        }
+
+        if (wheel->count == 0)
+        {
+            wheel->now = now_ms;
+        }
+    }
+
+    return expired;
+}
+
+int64_t timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t now_ms)
+{
+    uint64_t base = wheel->now;
+    uint64_t earliest = UINT64_MAX;
+
+    if (wheel->count == 0)
+    {
+        return -1;
+    }
+
+    //the first occupied slot of every level gives a candidate: a level 0
+    //slot its exact expiries, an upper slot the tick at which it cascades
+    //(its timers are due no earlier); an upper level may well come first,
+    //so every level is looked at and the earliest candidate wins
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        int shift = TIMER_WHEEL_BITS * level;
+        uint64_t position = base >> shift;
+
+        for (int step = 1; step <= TIMER_WHEEL_SLOTS; step++)
+        {
+            uint64_t slot_tick = (position + (uint64_t)step) << shift;
+            int index = (int)((position + (uint64_t)step) & TIMER_WHEEL_MASK);
+            const TimerEntry *entry = wheel->slots[level][index];
+
+            if (entry == NULL)
+            {
+                continue;
+            }
+
+            if (level == 0)
+            {
+                for (; entry != NULL; entry = entry->next)
+                {
+                    if (entry->expires < earliest)
+                    {
+                        earliest = entry->expires;
+                    }
+                }
+            }
+            else if (slot_tick < earliest)
+            {
+                earliest = slot_tick;
+            }
+
+            break;
+        }
+    }
+
+    if (earliest == UINT64_MAX)
+    {
+        return 0;
+    }
+
+    return earliest > now_ms ? (int64_t)(earliest - now_ms) : 0;
+}
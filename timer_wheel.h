@@ -0,0 +1,58 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+//hierarchical timing wheel with 1 ms ticks: level 0 holds timers due in the
+//next 64 ms, each higher level covers 64x the span of the one below and is
+//cascaded down as time reaches it; add/cancel are O(1)
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+//one pending timer, embedded in whatever object owns it
+typedef struct TimerEntry
+{
+    uint64_t expires;           //absolute expiry, ms on CLOCK_MONOTONIC
+    int pending;                //1 while linked into a wheel slot
+    int kind;                   //owner-defined tag telling timers apart
+    void *owner;                //owner-defined back pointer
+
+    struct TimerEntry *next;
+    struct TimerEntry **pprev;  //link pointing at this entry (slot head or prev->next)
+} TimerEntry;
+
+typedef struct
+{
+    uint64_t now;               //last tick the wheel was advanced to
+    int count;                  //number of pending timers
+    TimerEntry *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+//current CLOCK_MONOTONIC time in nanoseconds (service accounting)
+uint64_t timer_now_ns(void);
+
+//current CLOCK_MONOTONIC time in milliseconds (timer expiries)
+uint64_t timer_now_ms(void);
+
+//clearing a wheel and starting it at now_ms
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms);
+
+//preparing an entry so it can be armed/cancelled safely
+void timer_entry_init(TimerEntry *entry, int kind, void *owner);
+
+//arming (or re-arming) an entry to expire at expires_ms
+void timer_wheel_add(TimerWheel *wheel, TimerEntry *entry, uint64_t expires_ms);
+
+//disarming an entry; harmless when it is not pending
+void timer_wheel_cancel(TimerWheel *wheel, TimerEntry *entry);
+
+//advancing the wheel to now_ms and unlinking every timer that expired
+//returns the expired entries as a list chained through ->next (or null)
+TimerEntry *timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms);
+
+//milliseconds until the earliest timer may expire (a lower bound for timers
+//still parked on upper levels), or -1 when no timer is pending
+int64_t timer_wheel_next_timeout(const TimerWheel *wheel, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,681 @@
+#include "uring.h"
+
+#ifdef MYSHELL_IO_URING
+
+#include "reactor.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//user_data tags for requests that are not per-connection recvs
+#define URING_TAG_ACCEPT 1ULL
+#define URING_TAG_CANCEL 2ULL
+
+//buffer group id of the provided recv buffer ring
+#define URING_RECV_GROUP 0
+
+//minimal mmap'ed view of one io_uring instance (no liburing dependency)
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned to_submit;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} UringRing;
+
+static int g_uring_active = 0;
+static int g_listen_fd = -1;
+
+//accept/recv ring, owned by the single io_uring I/O thread
+static UringRing g_ring;
+
+//provided buffers: ring of descriptors plus the backing storage
+static struct io_uring_buf_ring *g_buf_ring = NULL;
+static char *g_buf_base = NULL;
+static size_t g_buf_ring_size = 0;
+
+//lazily created ring for linked sends from whichever thread is sending
+static __thread UringRing *t_send_ring = NULL;
+
+/* ---------- raw ring plumbing ---------- */
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ring_exit(UringRing *ring)
+{
+    if (ring->sqes != NULL)
+    {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr)
+    {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+
+    if (ring->sq_ptr != NULL)
+    {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+
+    if (ring->fd >= 0)
+    {
+        close(ring->fd);
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+static int ring_init(UringRing *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    char *sq;
+    char *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+
+    ring->fd = sys_io_uring_setup(entries, &params);
+
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+
+    ring->entries = params.sq_entries;
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size)
+        {
+            ring->sq_size = ring->cq_size;
+        }
+
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ptr == MAP_FAILED)
+    {
+        ring->sq_ptr = NULL;
+        ring_exit(ring);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ptr == MAP_FAILED)
+        {
+            ring->cq_ptr = NULL;
+            ring_exit(ring);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        ring_exit(ring);
+        return -1;
+    }
+
+    sq = (char *)ring->sq_ptr;
+    cq = (char *)ring->cq_ptr;
+
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+//submitting queued sqes and optionally waiting for wait_nr completions
+static int ring_submit(UringRing *ring, unsigned wait_nr)
+{
+    while (1)
+    {
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        int ret = sys_io_uring_enter(ring->fd, ring->to_submit, wait_nr, flags);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        ring->to_submit -= (unsigned)ret < ring->to_submit ? (unsigned)ret : ring->to_submit;
+        return ret;
+    }
+}
+
+//grabbing the next free sqe, flushing the ring when it is full
+static struct io_uring_sqe *ring_get_sqe(UringRing *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    if (tail - head >= ring->entries)
+    {
+        if (ring_submit(ring, 0) < 0)
+        {
+            return NULL;
+        }
+
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        if (tail - head >= ring->entries)
+        {
+            return NULL;
+        }
+    }
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+
+    return sqe;
+}
+
+static struct io_uring_cqe *ring_peek_cqe(UringRing *ring)
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return NULL;
+    }
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+static void ring_cqe_seen(UringRing *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* ---------- provided recv buffers ---------- */
+static void buffers_recycle(unsigned short bid)
+{
+    unsigned short tail = g_buf_ring->tail;
+    struct io_uring_buf *buf = &g_buf_ring->bufs[tail & (URING_RECV_BUFFERS - 1)];
+
+    buf->addr = (unsigned long)(g_buf_base + (size_t)bid * URING_RECV_BUFFER_SIZE);
+    buf->len = URING_RECV_BUFFER_SIZE;
+    buf->bid = bid;
+
+    __atomic_store_n(&g_buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static int buffers_register(void)
+{
+    struct io_uring_buf_reg reg;
+
+    g_buf_ring_size = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    g_buf_ring = mmap(NULL, g_buf_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (g_buf_ring == MAP_FAILED)
+    {
+        g_buf_ring = NULL;
+        return -1;
+    }
+
+    g_buf_base = malloc((size_t)URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE);
+
+    if (g_buf_base == NULL)
+    {
+        munmap(g_buf_ring, g_buf_ring_size);
+        g_buf_ring = NULL;
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)g_buf_ring;
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = URING_RECV_GROUP;
+
+    //provided buffer rings arrived together with multishot accept (5.19)
+    if (sys_io_uring_register(g_ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        free(g_buf_base);
+        g_buf_base = NULL;
+        munmap(g_buf_ring, g_buf_ring_size);
+        g_buf_ring = NULL;
+        return -1;
+    }
+
+    g_buf_ring->tail = 0;
+
+    for (unsigned short bid = 0; bid < URING_RECV_BUFFERS; bid++)
+    {
+        buffers_recycle(bid);
+    }
+
+    return 0;
+}
+
+/* ---------- request submission ---------- */
+static int submit_accept(void)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&g_ring);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = g_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = URING_TAG_ACCEPT;
+
+    return 0;
+}
+
+static int submit_recv(ClientContext *ctx)
+{
+    struct io_uring_sqe *sqe = ring_get_sqe(&g_ring);
+
+    if (sqe == NULL)
+    {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ctx->client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_GROUP;
+    sqe->user_data = (unsigned long long)(unsigned long)ctx;
+
+    return 0;
+}
+
+//cancelling the armed recv; the context is freed on its final completion
+static void submit_close(ClientContext *ctx)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ctx->closing)
+    {
+        return;
+    }
+
+    ctx->closing = 1;
+    sqe = ring_get_sqe(&g_ring);
+
+    if (sqe == NULL)
+    {
+        //no room to cancel: shutting the socket down ends the recv as well
+        shutdown(ctx->client_fd, SHUT_RDWR);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long long)(unsigned long)ctx;
+    sqe->user_data = URING_TAG_CANCEL;
+}
+
+/* ---------- completion handling ---------- */
+static void handle_accept(struct io_uring_cqe *cqe)
+{
+    if (cqe->res >= 0)
+    {
+        struct sockaddr_in address;
+        socklen_t address_length = sizeof(address);
+        ClientContext *ctx;
+
+        //multishot accept cannot fill a per-connection address
+        memset(&address, 0, sizeof(address));
+        getpeername(cqe->res, (struct sockaddr *)&address, &address_length);
+
+        ctx = session_open(cqe->res, &address);
+
+        if (ctx == NULL)
+        {
+            close(cqe->res);
+        }
+        else if (submit_recv(ctx) < 0)
+        {
+            session_close(ctx);
+        }
+    }
+    else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+    {
+        errno = -cqe->res;
+        perror("io_uring accept");
+    }
+
+    //re-arming when the kernel terminated the multishot request
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        submit_accept();
+    }
+}
+
+static void handle_recv(ClientContext *ctx, struct io_uring_cqe *cqe)
+{
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = g_buf_base + (size_t)bid * URING_RECV_BUFFER_SIZE;
+        int keep = 1;
+
+        if (!ctx->closing)
+        {
+            keep = reactor_frame_input(ctx, data, (size_t)cqe->res) == 0;
+            reactor_release_idle(ctx);
+        }
+
+        buffers_recycle(bid);
+
+        if (!keep)
+        {
+            submit_close(ctx);
+        }
+    }
+    else if (cqe->res == -ENOBUFS && !ctx->closing)
+    {
+        //every provided buffer was in use; the request ended, re-arm it
+        more = 0;
+        if (submit_recv(ctx) == 0)
+        {
+            return;
+        }
+        ctx->closing = 1;
+    }
+    else if (!more)
+    {
+        //eof, error or cancellation: no further completions will arrive
+        ctx->closing = 1;
+    }
+
+    if (!more)
+    {
+        if (ctx->closing)
+        {
+            session_close(ctx);
+        }
+        else if (submit_recv(ctx) < 0)
+        {
+            session_close(ctx);
+        }
+    }
+}
+
+static void uring_loop(void)
+{
+    while (1)
+    {
+        struct io_uring_cqe *cqe;
+
+        if (ring_submit(&g_ring, 1) < 0)
+        {
+            perror("io_uring_enter");
+            return;
+        }
+
+        //reaping every completion before the next single enter syscall
+        while ((cqe = ring_peek_cqe(&g_ring)) != NULL)
+        {
+            struct io_uring_cqe copy = *cqe;
+
+            ring_cqe_seen(&g_ring);
+
+            if (copy.user_data == URING_TAG_ACCEPT)
+            {
+                handle_accept(&copy);
+            }
+            else if (copy.user_data != URING_TAG_CANCEL)
+            {
+                handle_recv((ClientContext *)(unsigned long)copy.user_data, &copy);
+            }
+        }
+    }
+}
+
+int uring_run(int server_fd)
+{
+    if (ring_init(&g_ring, URING_ENTRIES) < 0)
+    {
+        return -1;
+    }
+
+    if (buffers_register() < 0)
+    {
+        ring_exit(&g_ring);
+        return -1;
+    }
+
+    g_listen_fd = server_fd;
+
+    if (submit_accept() < 0)
+    {
+        ring_exit(&g_ring);
+        return -1;
+    }
+
+    g_uring_active = 1;
+
+    log_printf_locked("[INFO] Using io_uring network backend.\n");
+
+    uring_loop();
+
+    g_uring_active = 0;
+    return -1;
+}
+
+int uring_active(void)
+{
+    return g_uring_active;
+}
+
+int uring_send_linked(int sockfd, const struct iovec *iov, int iovcnt)
+{
+    int done = 0;
+
+    if (t_send_ring == NULL)
+    {
+        UringRing *ring = malloc(sizeof(UringRing));
+
+        if (ring == NULL || ring_init(ring, URING_SEND_ENTRIES) < 0)
+        {
+            free(ring);
+            return send_allv_plain(sockfd, iov, iovcnt);
+        }
+
+        t_send_ring = ring;
+    }
+
+    while (done < iovcnt)
+    {
+        size_t sent[URING_SEND_ENTRIES];
+        struct io_uring_sqe *last = NULL;
+        int batch = iovcnt - done;
+        int reaped = 0;
+
+        if (batch > URING_SEND_ENTRIES)
+        {
+            batch = URING_SEND_ENTRIES;
+        }
+
+        for (int i = 0; i < batch; i++)
+        {
+            struct io_uring_sqe *sqe = ring_get_sqe(t_send_ring);
+
+            //no free sqe (a batch fits the ring, so not expected): the chain
+            //ends with the sends already prepared
+            if (sqe == NULL)
+            {
+                if (last != NULL)
+                {
+                    last->flags = 0;
+                }
+
+                batch = i;
+                break;
+            }
+
+            last = sqe;
+
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = sockfd;
+            sqe->addr = (unsigned long)iov[done + i].iov_base;
+            sqe->len = (unsigned)iov[done + i].iov_len;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->flags = (i + 1 < batch) ? IOSQE_IO_LINK : 0;
+            sqe->user_data = (unsigned long long)i;
+
+            sent[i] = 0;
+        }
+
+        if (batch == 0)
+        {
+            return send_allv_plain(sockfd, iov + done, iovcnt - done);
+        }
+
+        //one syscall submits the whole chain and waits for every link
+        if (ring_submit(t_send_ring, (unsigned)batch) < 0)
+        {
+            return send_allv_plain(sockfd, iov + done, iovcnt - done);
+        }
+
+        while (reaped < batch)
+        {
+            struct io_uring_cqe *cqe = ring_peek_cqe(t_send_ring);
+
+            if (cqe == NULL)
+            {
+                if (ring_submit(t_send_ring, 1) < 0)
+                {
+                    break;
+                }
+                continue;
+            }
+
+            if (cqe->res > 0 && cqe->user_data < (unsigned long long)batch)
+            {
+                sent[cqe->user_data] = (size_t)cqe->res;
+            }
+
+            ring_cqe_seen(t_send_ring);
+            reaped++;
+        }
+
+        //a short or failed link breaks the chain: finish the rest with send()
+        for (int i = 0; i < batch; i++)
+        {
+            const struct iovec *current = &iov[done + i];
+
+            if (sent[i] < current->iov_len)
+            {
+                struct iovec rest;
+
+                rest.iov_base = (char *)current->iov_base + sent[i];
+                rest.iov_len = current->iov_len - sent[i];
+
+                if (send_allv_plain(sockfd, &rest, 1) < 0)
+                {
+                    return -1;
+                }
+            }
+        }
+
+        done += batch;
+    }
+
+    return 0;
+}
+
+#else
+
+int uring_run(int server_fd)
+{
+    (void)server_fd;
+    return -1;
+}
+
+int uring_active(void)
+{
+    return 0;
+}
+
+int uring_send_linked(int sockfd, const struct iovec *iov, int iovcnt)
+{
+    return send_allv_plain(sockfd, iov, iovcnt);
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef URING_H
+#define URING_H
+
+#include "server_shared.h"
+
+#include <sys/uio.h>
+
+//optional io_uring network backend, compiled in with `make server IO_URING=1`
+//and selected at runtime with MYSHELL_NET=io_uring; every entry point
+//reports "unavailable" when it is compiled out so callers fall back to the
+//epoll reactor and plain send()
+
+//submission/completion ring size for the accept/recv ring
+#define URING_ENTRIES 256
+
+//provided recv buffers shared by all connections (count must be a power of 2)
+#define URING_RECV_BUFFERS 256
+#define URING_RECV_BUFFER_SIZE BUFFER_SIZE
+
+//per-thread ring used for linked send submissions
+#define URING_SEND_ENTRIES 32
+
+//running the io_uring backend on the listening socket: one multishot accept
+//plus one multishot provided-buffer recv per connection, all reaped by a
+//single I/O thread; never returns once running
+//returns -1 (socket untouched) when io_uring or a needed feature is missing
+int uring_run(int server_fd);
+
+//returns 1 once the io_uring backend owns the listening socket
+int uring_active(void);
+
+//sending every iovec as one chain of linked SEND submissions on the calling
+//thread's ring (one io_uring_enter for the whole chain); any short or failed
+//link is finished with plain send()
+//returns 0 on success, -1 on failure
+int uring_send_linked(int sockfd, const struct iovec *iov, int iovcnt);
+
+#endif